@@ -22,127 +22,398 @@
     DEALINGS IN THE SOFTWARE.
  */
 
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
 #include <libavcodec/avcodec.h>
 #include "frame.h"
 #include "codec.h"
+#include "lavcpool.h"
+
+#define MAX_BACKLOG 16
 
 static AVCodecContext *avc;
+static AVCodecContext *params;
+static AVFrame *frame;
+static struct lavc_pool pool;
+static AVFrame **backlog;
+static int num_backlog;
+static int pic_w;
+static int pic_h;
+static int threads = 1;
+static int max_lowres = -1;
+static int lowres;
+static enum AVDiscard skip_frame = AVDISCARD_DEFAULT;
+
+static uint64_t decode_time;
+static unsigned decode_frames;
+
+static int parse_params(const char *p)
+{
+    int len;
+
+    while ((len = strcspn(p, " ,;")) > 0) {
+        if (p[1] != '=')
+            goto err;
+
+        switch (p[0]) {
+        case 't':
+            threads = strtol(p + 2, NULL, 0);
+            break;
+        case 'l':
+            max_lowres = strtol(p + 2, NULL, 0);
+            break;
+        default:
+            goto err;
+        }
+
+        p += len + !!p[len];
+    }
 
-static int get_buffer(AVCodecContext *ctx, AVFrame *pic)
+    return 0;
+err:
+    fprintf(stderr, "avcodec: params: t=threads l=max_lowres\n");
+    return -1;
+}
+
+static int open_codec(struct frame_format *ff)
 {
-    struct frame *f = ofbp_get_frame();
-    int i;
+    int linesize_align[AV_NUM_DATA_POINTERS];
+    int w, h;
+    AVCodec *codec;
+    int err;
 
-    if (!f)
+    codec = avcodec_find_decoder(params->codec_id);
+    if (!codec) {
+        fprintf(stderr, "Can't find codec %x\n", params->codec_id);
         return -1;
+    }
+
+    avc = avcodec_alloc_context3(codec);
+    frame = av_frame_alloc();
+    if (!avc || !frame)
+        goto err;
+
+    avc->width          = params->width;
+    avc->height         = params->height;
+    avc->pix_fmt        = params->pix_fmt;
+    avc->time_base      = params->time_base;
+    avc->extradata      = params->extradata;
+    avc->extradata_size = params->extradata_size;
+    avc->thread_count   = threads;
+    avc->thread_type    = FF_THREAD_FRAME | FF_THREAD_SLICE;
+    avc->lowres         = lowres;
+    avc->skip_frame     = skip_frame;
+
+    if (codec->capabilities & AV_CODEC_CAP_DR1) {
+        avc->opaque      = &pool;
+        avc->get_buffer2 = ofbp_lavc_get_buffer2;
+    } else
+        fprintf(stderr, "avcodec: %s lacks direct rendering, copying\n",
+                codec->name);
 
-    for (i = 0; i < 3; i++) {
-        pic->data[i]     = f->vdata[i];
-        pic->linesize[i] = f->linesize[i];
+    err = avcodec_open2(avc, codec, NULL);
+    if (err) {
+        fprintf(stderr, "avcodec_open: %d\n", err);
+        goto err;
     }
 
-    pic->opaque = f;
-    pic->type = FF_BUFFER_TYPE_USER;
+    w = -(-params->width  >> lowres);
+    h = -(-params->height >> lowres);
+    ff->disp_w = w;
+    ff->disp_h = h;
+
+    avcodec_align_dimensions2(avc, &w, &h, linesize_align);
+
+    ff->width  = ALIGN(w, 64);
+    ff->height = h;
+    ff->disp_x = 0;
+    ff->disp_y = 0;
+    ff->pixfmt = avc->pix_fmt;
+
+    ofbp_lavc_reopen(&pool, ff->width, h, ff->pixfmt);
+    pic_w = ff->disp_w;
+    pic_h = ff->disp_h;
 
     return 0;
+err:
+    if (avc)
+        avc->extradata = NULL;
+    avcodec_free_context(&avc);
+    av_frame_free(&frame);
+    return -1;
 }
 
-static void release_buffer(AVCodecContext *ctx, AVFrame *pic)
+static int lavc_open(const char *name, AVCodecContext *cc,
+                     struct frame_format *ff)
 {
-    struct frame *f = pic->opaque;
-    int i;
+    if (name && parse_params(name))
+        return -1;
+
+    params = cc;
+    lowres = 0;
+
+    return open_codec(ff);
+}
+
+/* The stream changed size or pixel format.  The pool may be replaced,
+   so the decoder must not hold on to any of its frames by then. */
+static int format_change(AVFrame *pic)
+{
+    int linesize_align[AV_NUM_DATA_POINTERS];
+    struct frame_format ff = { 0 };
+    int w = pic->width;
+    int h = pic->height;
 
-    for (i = 0; i < 3; i++)
-        pic->data[i] = NULL;
+    fprintf(stderr, "avcodec: format change %dx%d -> %dx%d\n",
+            pic_w, pic_h, w, h);
 
-    ofbp_put_frame(f);
+    ff.disp_w = w;
+    ff.disp_h = h;
+    ff.pixfmt = pic->format;
+
+    avcodec_align_dimensions2(avc, &w, &h, linesize_align);
+    ff.width  = ALIGN(w, 64);
+    ff.height = h;
+
+    if (ofbp_reconfigure(&ff))
+        return -1;
+
+    ofbp_lavc_reopen(&pool, ff.width, ff.height, pic->format);
+    pic_w = pic->width;
+    pic_h = pic->height;
+
+    return 0;
 }
 
+static int output_frame(AVFrame *pic);
 
-static int
-reget_buffer(AVCodecContext *ctx, AVFrame *pic)
+/* Pictures in a new format wait here, in ordinary buffers, until the
+   decoder has released the last frame of the old pool.  Then the pool
+   is switched over and they are posted. */
+static int release_backlog(void)
 {
-    struct frame *f = pic->opaque;
-    fprintf(stderr, "reget_buffer   %2d\n", f->frame_num);
+    AVFrame **bl = backlog;
+    int n = num_backlog;
+    int err = 0;
+    int i;
 
-    if (!pic->data[0]) {
-        pic->buffer_hints |= FF_BUFFER_HINTS_READABLE;
-        return get_buffer(ctx, pic);
+    if (!n || ofbp_lavc_held())
+        return 0;
+
+    backlog = NULL;
+    num_backlog = 0;
+
+    err = format_change(bl[0]);
+    for (i = 0; i < n; i++) {
+        if (!err)
+            err = output_frame(bl[i]);
+        av_frame_free(&bl[i]);
     }
+    free(bl);
 
-    return 0;
+    return err;
 }
 
-static int lavc_open(const char *name, AVCodecContext *params,
-                     struct frame_format *ff)
+static int hold_back(AVFrame *pic)
 {
-    int x_off, y_off;
-    int edge_width;
-    AVCodec *codec;
-    int err;
+    AVFrame **bl;
 
-    codec = avcodec_find_decoder(params->codec_id);
-    if (!codec) {
-        fprintf(stderr, "Can't find codec %x\n", params->codec_id);
+    if (!num_backlog)
+        ofbp_lavc_close(&pool);
+
+    if (num_backlog == MAX_BACKLOG) {
+        fprintf(stderr, "avcodec: decoder still holds %d pool frames, "
+                "dropping a picture\n", ofbp_lavc_held());
+        av_frame_free(&backlog[0]);
+        memmove(backlog, backlog + 1, --num_backlog * sizeof(*backlog));
+    }
+
+    bl = realloc(backlog, (num_backlog + 1) * sizeof(*bl));
+    if (!bl)
+        return -1;
+    backlog = bl;
+
+    /* A picture in a pool frame would keep the old pool alive. */
+    if (pic->opaque) {
+        AVFrame *c = av_frame_alloc();
+
+        if (!c)
+            return -1;
+        c->format = pic->format;
+        c->width  = pic->width;
+        c->height = pic->height;
+        if (av_frame_get_buffer(c, 0) < 0 || av_frame_copy(c, pic) < 0 ||
+            av_frame_copy_props(c, pic) < 0) {
+            av_frame_free(&c);
+            return -1;
+        }
+        c->opaque = NULL;
+        backlog[num_backlog] = c;
+    } else if (!(backlog[num_backlog] = av_frame_clone(pic))) {
         return -1;
     }
+    num_backlog++;
 
-    avc = avcodec_alloc_context3(codec);
+    return release_backlog();
+}
 
-    avc->width          = params->width;
-    avc->height         = params->height;
-    avc->time_base      = params->time_base;
-    avc->extradata      = params->extradata;
-    avc->extradata_size = params->extradata_size;
+static int output_frame(AVFrame *pic)
+{
+    if (num_backlog || pic->width != pic_w || pic->height != pic_h ||
+        pic->format != pool.pixfmt)
+        return hold_back(pic);
 
-    avc->get_buffer     = get_buffer;
-    avc->release_buffer = release_buffer;
-    avc->reget_buffer   = reget_buffer;
+    return ofbp_lavc_output(pic, &pool);
+}
 
-    err = avcodec_open2(avc, codec, NULL);
-    if (err) {
-        fprintf(stderr, "avcodec_open: %d\n", err);
-        return err;
+static void free_backlog(void)
+{
+    while (num_backlog)
+        av_frame_free(&backlog[--num_backlog]);
+    free(backlog);
+    backlog = NULL;
+}
+
+static int lavc_decode(AVPacket *p)
+{
+    struct timespec t1, t2;
+    int err;
+
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+
+    err = avcodec_send_packet(avc, p);
+    if (err < 0 && err != AVERROR_EOF)
+        return -1;
+
+    while (!(err = avcodec_receive_frame(avc, frame))) {
+        clock_gettime(CLOCK_MONOTONIC, &t2);
+        decode_time += (t2.tv_sec - t1.tv_sec) * 1000000000LL +
+            t2.tv_nsec - t1.tv_nsec;
+        decode_frames++;
+
+        err = output_frame(frame);
+        av_frame_unref(frame);
+        if (err)
+            return -1;
+
+        clock_gettime(CLOCK_MONOTONIC, &t1);
     }
 
-    edge_width = avcodec_get_edge_width();
-    x_off      = ALIGN(edge_width, 32);
-    y_off      = edge_width;
+    clock_gettime(CLOCK_MONOTONIC, &t2);
+    decode_time += (t2.tv_sec - t1.tv_sec) * 1000000000LL +
+        t2.tv_nsec - t1.tv_nsec;
 
-    ff->width  = ALIGN(params->width  + 2 * x_off, 32);
-    ff->height = ALIGN(params->height + 2 * y_off, 32);
-    ff->disp_x = x_off;
-    ff->disp_y = y_off;
-    ff->disp_w = params->width;
-    ff->disp_h = params->height;
-    ff->pixfmt = params->pix_fmt;
+    if (err != AVERROR(EAGAIN) && err != AVERROR_EOF)
+        return -1;
 
-    return 0;
+    /* At the end of the stream nothing more will be decoded, so the
+       decoder can let go of its references now. */
+    if (num_backlog && !p)
+        avcodec_flush_buffers(avc);
+
+    return release_backlog();
 }
 
-static int lavc_decode(AVPacket *p)
+static void lavc_close(void)
+{
+    if (decode_frames)
+        fprintf(stderr, "avcodec: %u frames, %u us/frame, lowres %d "
+                "(1/%d of the pixels)\n", decode_frames,
+                (unsigned)(decode_time / decode_frames / 1000),
+                lowres, 1 << 2 * lowres);
+
+    decode_time   = 0;
+    decode_frames = 0;
+
+    free_backlog();
+
+    if (avc)
+        avc->extradata = NULL;
+    avcodec_free_context(&avc);
+    av_frame_free(&frame);
+}
+
+/* Decode at 1/2, 1/4 or 1/8 size when the picture will be shown at
+   no more than that size anyway. */
+static int lavc_downscale(struct frame_format *ff, unsigned w, unsigned h)
 {
-    AVFrame f;
-    int gp = 0;
+    int max = avc->codec->max_lowres;
+    int l = 0;
+
+    if (max_lowres >= 0)
+        max = MIN(max, max_lowres);
+
+    while (l < max && (ff->disp_w >> (l + 1)) >= w &&
+           (ff->disp_h >> (l + 1)) >= h)
+        l++;
+
+    if (!l)
+        return 0;
 
-    if (avcodec_decode_video2(avc, &f, &gp, p) < 0)
+    lavc_close();
+    lowres = l;
+
+    if (open_codec(ff))
         return -1;
 
-    if (gp)
-        ofbp_post_frame(f.opaque);
+    fprintf(stderr, "avcodec: lowres %d, decoding %dx%d for %dx%d output\n",
+            lowres, ff->disp_w, ff->disp_h, w, h);
+
+    return 1;
+}
+
+static void lavc_discard(enum AVDiscard skip)
+{
+    skip_frame = skip;
+    if (avc)
+        avc->skip_frame = skip;
+}
+
+static void lavc_flush(void)
+{
+    avcodec_flush_buffers(avc);
+    free_backlog();
+    ofbp_lavc_reopen(&pool, pool.width, pool.height, pool.pixfmt);
+}
+
+/* Carry on with the next playlist item's stream if it needs nothing
+   a flush doesn't give: the same codec, pixel format and extradata.
+   A new picture size is taken as a format change. */
+static int lavc_reuse(AVCodecContext *cc)
+{
+    if (cc->codec_id != params->codec_id ||
+        cc->pix_fmt != params->pix_fmt ||
+        cc->extradata_size != params->extradata_size ||
+        (cc->extradata_size &&
+         memcmp(cc->extradata, params->extradata, cc->extradata_size)))
+        return -1;
+
+    lavc_flush();
+
+    params = cc;
+    avc->extradata = cc->extradata;
+    avc->time_base = cc->time_base;
+
+    fprintf(stderr, "avcodec: decoder kept for the next item\n");
 
     return 0;
 }
 
-static void lavc_close(void)
+static unsigned lavc_num_frames(void)
 {
-    avcodec_close(avc);
-    av_freep(&avc);
+    return ofbp_lavc_num_frames(params, avc);
 }
 
 CODEC(avcodec) = {
-    .name   = "avcodec",
-    .open   = lavc_open,
-    .decode = lavc_decode,
-    .close  = lavc_close,
+    .name       = "avcodec",
+    .open       = lavc_open,
+    .decode     = lavc_decode,
+    .close      = lavc_close,
+    .downscale  = lavc_downscale,
+    .discard    = lavc_discard,
+    .flush      = lavc_flush,
+    .reuse      = lavc_reuse,
+    .num_frames = lavc_num_frames,
 };
@@ -29,6 +29,7 @@
 
 #include "frame.h"
 #include "memman.h"
+#include "pixfmt.h"
 #include "util.h"
 
 static CMEM_AllocParams cma;
@@ -38,28 +39,26 @@ static int
 cmem_alloc_frames(struct frame_format *ff, unsigned bufsize,
                   struct frame **fr, unsigned *nf)
 {
-    int buf_w = ff->width, buf_h = ff->height;
+    struct frame_layout fl;
     struct frame *frames;
     unsigned num_frames;
     unsigned frame_size;
     uint8_t *phys;
-    unsigned y_offset;
     int i;
 
     if (CMEM_init())
         return -1;
 
-    frame_size = buf_w * buf_h * 3 / 2;
+    ofbp_frame_layout(&fl, ff->width, ff->height);
+    frame_size = fl.size;
     num_frames = MAX(bufsize / frame_size, MIN_FRAMES);
     bufsize = num_frames * frame_size;
 
-    y_offset = buf_w * buf_h;
-
     fprintf(stderr, "CMEM: using %d frame buffers\n", num_frames);
 
     cma.type      = CMEM_HEAP;
     cma.flags     = CMEM_CACHED;
-    cma.alignment = 16;
+    cma.alignment = 64;
 
     frame_buf = CMEM_alloc(bufsize, &cma);
 
@@ -73,22 +72,23 @@ cmem_alloc_frames(struct frame_format *ff, unsigned bufsize,
     frames = malloc(num_frames * sizeof(*frames));
 
     for (i = 0; i < num_frames; i++) {
-        uint8_t *p = frame_buf + i * frame_size;
-        uint8_t *pp = phys + i * frame_size;
+        unsigned offs = i * frame_size + ofbp_frame_colour(i);
+        uint8_t *p = frame_buf + offs;
+        uint8_t *pp = phys + offs;
 
         frames[i].virt[0] = p;
-        frames[i].virt[1] = p + y_offset;
-        frames[i].virt[2] = p + y_offset + buf_w / 2;
+        frames[i].virt[1] = p + fl.uv_offset;
+        frames[i].virt[2] = p + fl.uv_offset + fl.v_offset;
         frames[i].phys[0] = pp;
-        frames[i].phys[1] = pp + y_offset;
-        frames[i].phys[2] = pp + y_offset + buf_w / 2;
-        frames[i].linesize[0] = ff->width;
-        frames[i].linesize[1] = ff->width;
-        frames[i].linesize[2] = ff->width;
+        frames[i].phys[1] = pp + fl.uv_offset;
+        frames[i].phys[2] = pp + fl.uv_offset + fl.v_offset;
+        frames[i].linesize[0] = fl.stride;
+        frames[i].linesize[1] = fl.stride;
+        frames[i].linesize[2] = fl.stride;
     }
 
-    ff->y_stride  = ff->width;
-    ff->uv_stride = ff->width;
+    ff->y_stride  = fl.stride;
+    ff->uv_stride = fl.stride;
 
     *fr = frames;
     *nf = num_frames;
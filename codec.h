@@ -26,6 +26,8 @@
 #define OFBP_CODEC_H
 
 #include <libavcodec/avcodec.h>
+#include <libavformat/avformat.h>
+#include "memman.h"
 #include "util.h"
 
 struct codec {
@@ -34,7 +36,14 @@ struct codec {
     int (*open)(const char *name, AVCodecContext *params,
                 struct frame_format *ff);
     int (*decode)(AVPacket *p);
+    int (*read)(AVFormatContext *afc);
     void (*close)(void);
+    int (*downscale)(struct frame_format *ff, unsigned w, unsigned h);
+    void (*discard)(enum AVDiscard skip);
+    void (*flush)(void);
+    int (*reuse)(AVCodecContext *params);
+    unsigned (*num_frames)(void);
+    const struct memman *memman;
 };
 
 extern const struct codec *ofbp_codec_start[];
@@ -103,7 +103,7 @@ static int dce_open(const char *name, AVCodecContext *cc,
     Engine_Error ec;
     XDAS_Int32 err;
 
-    if (cc->codec_id != CODEC_ID_H264) {
+    if (cc->codec_id != AV_CODEC_ID_H264) {
         fprintf(stderr, "DCE: unsupported codec %d\n", cc->codec_id);
         return -1;
     }
@@ -121,7 +121,7 @@ static int dce_open(const char *name, AVCodecContext *cc,
     ff->disp_y = 0;
     ff->disp_w = cc->width;
     ff->disp_h = cc->height;
-    ff->pixfmt = PIX_FMT_NV12;
+    ff->pixfmt = AV_PIX_FMT_NV12;
 
     engine = Engine_open("ivahd_vidsvr", NULL, &ec);
     if (!engine) {
@@ -233,6 +233,9 @@ static int dce_decode(AVPacket *p)
     int err;
     int i;
 
+    if (!p)
+        return 0;
+
     if (bsf) {
         if (av_bitstream_filter_filter(bsf, avc, NULL, &buf, &bufsize,
                                        p->data, p->size, 0) < 0) {
@@ -259,6 +262,8 @@ static int dce_decode(AVPacket *p)
         f->phys[1] = (uint8_t*)TilerMem_VirtToPhys(f->virt[1]);
     }
 
+    f->pts = p->pts;
+
     in_args->inputID  = (XDAS_Int32)f;
     in_args->numBytes = bufsize;
 
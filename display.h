@@ -31,6 +31,10 @@
 #include "pixconv.h"
 #include "util.h"
 
+/* A display that shows no pixels sets df->pixfmt to AV_PIX_FMT_NONE
+   in open and is enabled without a pixel converter.  import, if set,
+   returns 0 if frames of format ff from an OFBP_DMABUF memman can be
+   shown as they are; they then come without a pixel converter too. */
 struct display {
     const char *name;
     unsigned flags;
@@ -39,8 +43,10 @@ struct display {
     int  (*enable)(struct frame_format *fmt, unsigned flags,
                    const struct pixconv *pc, struct frame_format *df);
     void (*prepare)(struct frame *f);
+    int  (*wait)(int64_t delay);
     void (*show)(struct frame *f);
     void (*close)(void);
+    int  (*import)(const struct frame_format *ff);
     const struct memman *memman;
 };
 
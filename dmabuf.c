@@ -0,0 +1,90 @@
+/*
+    Copyright (C) 2026 Mans Rullgard
+
+    Permission is hereby granted, free of charge, to any person
+    obtaining a copy of this software and associated documentation
+    files (the "Software"), to deal in the Software without
+    restriction, including without limitation the rights to use, copy,
+    modify, merge, publish, distribute, sublicense, and/or sell copies
+    of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be
+    included in all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+    EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+    MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+    NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+    HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+    WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+    DEALINGS IN THE SOFTWARE.
+ */
+
+#include <stdio.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <linux/dma-buf.h>
+#include <linux/dma-heap.h>
+#include <linux/udmabuf.h>
+
+#include "dmabuf.h"
+
+/* Wrap a page-aligned range of a sealed memfd in a dmabuf. */
+int ofbp_udmabuf(int memfd, size_t offset, size_t size)
+{
+    struct udmabuf_create uc = { 0 };
+    int fd, dfd;
+
+    fd = open("/dev/udmabuf", O_RDWR);
+    if (fd == -1)
+        return -1;
+
+    uc.memfd  = memfd;
+    uc.flags  = UDMABUF_FLAGS_CLOEXEC;
+    uc.offset = offset;
+    uc.size   = size;
+
+    dfd = ioctl(fd, UDMABUF_CREATE, &uc);
+    close(fd);
+
+    return dfd;
+}
+
+int ofbp_dma_heap_open(const char *name)
+{
+    char path[64];
+
+    snprintf(path, sizeof(path), "/dev/dma_heap/%s", name);
+
+    return open(path, O_RDWR | O_CLOEXEC);
+}
+
+int ofbp_dma_heap_alloc(int heap, size_t size)
+{
+    struct dma_heap_allocation_data ha = { 0 };
+
+    ha.len      = size;
+    ha.fd_flags = O_RDWR | O_CLOEXEC;
+
+    if (ioctl(heap, DMA_HEAP_IOCTL_ALLOC, &ha))
+        return -1;
+
+    return ha.fd;
+}
+
+/* Bracket CPU access to a dmabuf, flags as for DMA_BUF_IOCTL_SYNC. */
+int ofbp_dmabuf_sync(int fd, unsigned flags)
+{
+    struct dma_buf_sync sync = { flags };
+    int err;
+
+    do {
+        err = ioctl(fd, DMA_BUF_IOCTL_SYNC, &sync);
+    } while (err && (errno == EINTR || errno == EAGAIN));
+
+    return err;
+}
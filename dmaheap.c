@@ -0,0 +1,230 @@
+/*
+    Copyright (C) 2026 Mans Rullgard
+
+    Permission is hereby granted, free of charge, to any person
+    obtaining a copy of this software and associated documentation
+    files (the "Software"), to deal in the Software without
+    restriction, including without limitation the rights to use, copy,
+    modify, merge, publish, distribute, sublicense, and/or sell copies
+    of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be
+    included in all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+    EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+    MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+    NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+    HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+    WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+    DEALINGS IN THE SOFTWARE.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <linux/dma-buf.h>
+
+#include "frame.h"
+#include "memman.h"
+#include "pixfmt.h"
+#include "dmabuf.h"
+#include "util.h"
+
+/*
+ * Frames as dmabufs, one per frame, so they can be handed to any
+ * device that imports dmabufs.  Buffers come from the system dma-buf
+ * heap; without one, from a sealed memfd wrapped by udmabuf.  Each
+ * frame's fd is in frame->dmabuf_fd with the planes at the same
+ * offsets from virt[0] as in the mapping.  As with the system memman,
+ * frame n starts ofbp_frame_colour(n) bytes into its buffer.
+ */
+
+static struct frame *frames;
+static unsigned num_frames;
+static size_t frame_size;
+static int pool_fd = -1;
+static uint8_t *pool_mem;
+
+static void
+dmaheap_free_frames(struct frame *fr, unsigned nf)
+{
+    int i;
+
+    for (i = 0; i < num_frames; i++) {
+        if (!pool_mem && frames[i].virt[0])
+            munmap(frames[i].virt[0] - ofbp_frame_colour(i), frame_size);
+        if (frames[i].dmabuf_fd != -1)
+            close(frames[i].dmabuf_fd);
+    }
+
+    if (pool_mem)
+        munmap(pool_mem, (size_t)num_frames * frame_size);
+    pool_mem = NULL;
+
+    if (pool_fd != -1)
+        close(pool_fd);
+    pool_fd = -1;
+
+    free(frames);
+    frames = NULL;
+}
+
+static int
+alloc_heap(int heap)
+{
+    int i;
+
+    for (i = 0; i < num_frames; i++) {
+        struct frame *f = frames + i;
+        void *p;
+
+        f->dmabuf_fd = ofbp_dma_heap_alloc(heap, frame_size);
+        if (f->dmabuf_fd == -1) {
+            perror("DMA_HEAP_IOCTL_ALLOC");
+            return -1;
+        }
+
+        p = mmap(NULL, frame_size, PROT_READ | PROT_WRITE, MAP_SHARED,
+                 f->dmabuf_fd, 0);
+        if (p == MAP_FAILED) {
+            perror("mmap");
+            return -1;
+        }
+
+        f->virt[0] = (uint8_t *)p + ofbp_frame_colour(i);
+    }
+
+    return 0;
+}
+
+static int
+alloc_udmabuf(void)
+{
+    size_t pool_size = (size_t)num_frames * frame_size;
+    int i;
+
+    pool_fd = memfd_create("omapfbplay", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+    if (pool_fd == -1) {
+        perror("memfd_create");
+        return -1;
+    }
+
+    if (ftruncate(pool_fd, pool_size)) {
+        perror("ftruncate");
+        return -1;
+    }
+
+    fcntl(pool_fd, F_ADD_SEALS, F_SEAL_SHRINK);
+
+    pool_mem = mmap(NULL, pool_size, PROT_READ | PROT_WRITE, MAP_SHARED,
+                    pool_fd, 0);
+    if (pool_mem == MAP_FAILED) {
+        perror("mmap");
+        pool_mem = NULL;
+        return -1;
+    }
+
+    for (i = 0; i < num_frames; i++) {
+        struct frame *f = frames + i;
+        size_t offset = (size_t)i * frame_size;
+
+        f->dmabuf_fd = ofbp_udmabuf(pool_fd, offset, frame_size);
+        if (f->dmabuf_fd == -1) {
+            perror("udmabuf");
+            return -1;
+        }
+
+        f->virt[0] = pool_mem + offset + ofbp_frame_colour(i);
+    }
+
+    return 0;
+}
+
+static int
+dmaheap_alloc_frames(struct frame_format *ff, unsigned bufsize,
+                     struct frame **fr, unsigned *nf)
+{
+    struct frame_layout fl;
+    const char *src;
+    int heap;
+    int err;
+    int i;
+
+    ofbp_frame_layout(&fl, ff->width, ff->height);
+    frame_size = ALIGN(fl.size, sysconf(_SC_PAGESIZE));
+    num_frames = MAX(bufsize / frame_size, MIN_FRAMES);
+
+    frames = calloc(num_frames, sizeof(*frames));
+    if (!frames)
+        return -1;
+
+    for (i = 0; i < num_frames; i++)
+        frames[i].dmabuf_fd = -1;
+
+    heap = ofbp_dma_heap_open("system");
+    if (heap != -1) {
+        src = "system heap";
+        err = alloc_heap(heap);
+        close(heap);
+    } else {
+        src = "udmabuf";
+        err = alloc_udmabuf();
+    }
+
+    if (err) {
+        fprintf(stderr, "Error allocating dmabuf frame buffers\n");
+        dmaheap_free_frames(frames, num_frames);
+        return -1;
+    }
+
+    for (i = 0; i < num_frames; i++) {
+        struct frame *f = frames + i;
+
+        f->virt[1] = f->virt[0] + fl.uv_offset;
+        f->virt[2] = f->virt[1] + fl.v_offset;
+        f->linesize[0] = fl.stride;
+        f->linesize[1] = fl.stride;
+        f->linesize[2] = fl.stride;
+    }
+
+    fprintf(stderr, "dmaheap: %d frame buffers from %s, frame_size=%zu\n",
+            num_frames, src, frame_size);
+
+    ff->y_stride  = fl.stride;
+    ff->uv_stride = fl.stride;
+
+    *fr = frames;
+    *nf = num_frames;
+
+    return 0;
+}
+
+/* The pool hands a frame out for the CPU to fill and gets it back
+   when it is posted for display, bracket that. */
+static void
+dmaheap_begin_cpu(struct frame *f)
+{
+    ofbp_dmabuf_sync(f->dmabuf_fd, DMA_BUF_SYNC_START | DMA_BUF_SYNC_RW);
+}
+
+static void
+dmaheap_end_cpu(struct frame *f)
+{
+    ofbp_dmabuf_sync(f->dmabuf_fd, DMA_BUF_SYNC_END | DMA_BUF_SYNC_RW);
+}
+
+DRIVER(memman, dmaheap) = {
+    .name         = "dmaheap",
+    .flags        = OFBP_DMABUF,
+    .alloc_frames = dmaheap_alloc_frames,
+    .free_frames  = dmaheap_free_frames,
+    .begin_cpu    = dmaheap_begin_cpu,
+    .end_cpu      = dmaheap_end_cpu,
+};
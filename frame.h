@@ -33,7 +33,7 @@ struct frame_format {
     unsigned disp_x, disp_y;
     unsigned disp_w, disp_h;
     unsigned y_stride, uv_stride;
-    enum PixelFormat pixfmt;
+    enum AVPixelFormat pixfmt;
 };
 
 struct frame {
@@ -42,17 +42,24 @@ struct frame {
     uint8_t *vdata[3];
     uint8_t *pdata[3];
     int linesize[3];
+    int dmabuf_fd;
     int x, y;
+    int64_t pts;
     int frame_num;
     int next;
     int prev;
     int refs;
+    int resident;
+    int cpu_access;
+    unsigned free_time;
 };
 
 #define MIN_FRAMES 2
 
 struct frame *ofbp_get_frame(void);
+struct frame *ofbp_get_frame_timed(unsigned ms);
 void ofbp_put_frame(struct frame *f);
 void ofbp_post_frame(struct frame *f);
+int ofbp_reconfigure(struct frame_format *ff);
 
 #endif
@@ -0,0 +1,531 @@
+/*
+    Copyright (C) 2026 Mans Rullgard
+
+    Permission is hereby granted, free of charge, to any person
+    obtaining a copy of this software and associated documentation
+    files (the "Software"), to deal in the Software without
+    restriction, including without limitation the rights to use, copy,
+    modify, merge, publish, distribute, sublicense, and/or sell copies
+    of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be
+    included in all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+    EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+    MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+    NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+    HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+    WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+    DEALINGS IN THE SOFTWARE.
+ */
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <libavcodec/avcodec.h>
+
+#include "frame.h"
+#include "codec.h"
+#include "lavcpool.h"
+#include "util.h"
+
+/*
+ * Closed-GOP parallel decoder.  Each GOP, from one keyframe up to the
+ * next, is handed as a whole to one of several independent decoder
+ * instances.  Decoded pictures are queued per instance and posted
+ * from the demuxer thread in GOP order, so the display sees them in
+ * presentation order.  Only streams where no picture references
+ * across a keyframe decode correctly this way.
+ */
+
+#define MAX_WORKERS 16
+
+struct worker {
+    pthread_t thread;
+    AVCodecContext *avc;
+    AVFrame *frame;
+    AVPacket **pkts;
+    int num_pkts;
+    unsigned seq;
+    int busy;
+    int decoded;
+    AVFrame **out;
+    int out_head;
+    int num_out;
+    int err;
+};
+
+static struct worker workers[MAX_WORKERS];
+static int num_workers;
+static int threads = 1;
+static int max_out = 4;
+
+static AVPacket **gop_pkts;
+static int gop_len;
+static int gop_size;
+static unsigned next_seq;
+static unsigned head_seq;
+
+static pthread_mutex_t gop_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t gop_cond = PTHREAD_COND_INITIALIZER;
+static int quit;
+static int flushing;
+
+static unsigned dec_frames;
+
+static struct frame *get_frame(void);
+static struct lavc_pool pool = { .get_frame = get_frame };
+
+static int parse_params(const char *p)
+{
+    int len;
+
+    while ((len = strcspn(p, " ,;")) > 0) {
+        if (p[1] != '=')
+            goto err;
+
+        switch (p[0]) {
+        case 'n':
+            num_workers = strtol(p + 2, NULL, 0);
+            break;
+        case 't':
+            threads = strtol(p + 2, NULL, 0);
+            break;
+        case 'f':
+            max_out = strtol(p + 2, NULL, 0);
+            break;
+        default:
+            goto err;
+        }
+
+        p += len + !!p[len];
+    }
+
+    if (num_workers > MAX_WORKERS || max_out < 1)
+        goto err;
+
+    return 0;
+err:
+    fprintf(stderr, "gop: params: n=decoders (max %d) t=threads "
+            "f=frames queued per decoder\n", MAX_WORKERS);
+    return -1;
+}
+
+/* A decoder waiting for a pool frame holds others already, so never
+   wait for good: poll so that a flush or close gets through. */
+static struct frame *get_frame(void)
+{
+    struct frame *f;
+
+    while (!(f = ofbp_get_frame_timed(50)))
+        if (quit || flushing)
+            return NULL;
+
+    return f;
+}
+
+/* Queue a decoded picture.  Waits while the queue is full; the
+   queue of the oldest GOP is emptied by gop_decode(). */
+static void queue_frame(struct worker *w)
+{
+    pthread_mutex_lock(&gop_lock);
+
+    while (w->num_out == max_out && !quit && !flushing)
+        pthread_cond_wait(&gop_cond, &gop_lock);
+
+    if (!quit && !flushing) {
+        AVFrame *pic = w->out[(w->out_head + w->num_out) % max_out];
+        av_frame_move_ref(pic, w->frame);
+        w->num_out++;
+        pthread_cond_broadcast(&gop_cond);
+    }
+
+    pthread_mutex_unlock(&gop_lock);
+
+    av_frame_unref(w->frame);
+}
+
+static int decode_packet(struct worker *w, AVPacket *p)
+{
+    int err = avcodec_send_packet(w->avc, p);
+    if (err < 0 && err != AVERROR_EOF)
+        return -1;
+
+    while (!(err = avcodec_receive_frame(w->avc, w->frame)))
+        queue_frame(w);
+
+    return err == AVERROR(EAGAIN) || err == AVERROR_EOF ? 0 : -1;
+}
+
+static void *worker_thread(void *p)
+{
+    struct worker *w = p;
+    int i;
+
+    pthread_mutex_lock(&gop_lock);
+
+    for (;;) {
+        while (!quit && (!w->busy || w->decoded))
+            pthread_cond_wait(&gop_cond, &gop_lock);
+
+        if (quit)
+            break;
+
+        pthread_mutex_unlock(&gop_lock);
+
+        for (i = 0; i < w->num_pkts && !w->err && !quit && !flushing; i++)
+            w->err = decode_packet(w, w->pkts[i]);
+        if (!w->err && !quit && !flushing)
+            w->err = decode_packet(w, NULL);
+        avcodec_flush_buffers(w->avc);
+
+        for (i = 0; i < w->num_pkts; i++)
+            av_packet_free(&w->pkts[i]);
+        free(w->pkts);
+        w->pkts = NULL;
+        w->num_pkts = 0;
+
+        pthread_mutex_lock(&gop_lock);
+        w->decoded = 1;
+        pthread_cond_broadcast(&gop_cond);
+    }
+
+    pthread_mutex_unlock(&gop_lock);
+
+    return NULL;
+}
+
+static struct worker *find_worker(unsigned seq)
+{
+    int i;
+
+    for (i = 0; i < num_workers; i++)
+        if (workers[i].busy && workers[i].seq == seq)
+            return &workers[i];
+
+    return NULL;
+}
+
+enum { WAIT_NONE, WAIT_IDLE, WAIT_ALL };
+
+/* Post everything the oldest GOP has produced so far, moving on to
+   the next GOP when one is complete.  Then wait, still posting, for
+   a decoder to become idle or for all of them to finish, as 'until'
+   says.  Called with gop_lock held. */
+
+static int output_frames(int until)
+{
+    struct worker *w;
+    int err = 0;
+
+    for (;;) {
+        int idle = 0;
+        int i;
+
+        while ((w = find_worker(head_seq)) && w->num_out) {
+            AVFrame *pic = w->out[w->out_head];
+            w->out_head = (w->out_head + 1) % max_out;
+            w->num_out--;
+            pthread_cond_broadcast(&gop_cond);
+
+            pthread_mutex_unlock(&gop_lock);
+            ofbp_lavc_output(pic, &pool);
+            av_frame_unref(pic);
+            pthread_mutex_lock(&gop_lock);
+        }
+
+        if (w && w->decoded) {
+            err |= w->err;
+            w->busy = 0;
+            w->err = 0;
+            head_seq++;
+            continue;
+        }
+
+        for (i = 0; i < num_workers; i++)
+            idle += !workers[i].busy;
+
+        if (until == WAIT_NONE ||
+            (until == WAIT_IDLE && idle) ||
+            (until == WAIT_ALL && idle == num_workers))
+            break;
+
+        pthread_cond_wait(&gop_cond, &gop_lock);
+    }
+
+    return err ? -1 : 0;
+}
+
+static int start_gop(void)
+{
+    struct worker *w = NULL;
+    int err;
+    int i;
+
+    err = output_frames(WAIT_IDLE);
+
+    for (i = 0; i < num_workers; i++) {
+        if (!workers[i].busy) {
+            w = &workers[i];
+            break;
+        }
+    }
+
+    w->pkts     = gop_pkts;
+    w->num_pkts = gop_len;
+    w->seq      = next_seq++;
+    w->busy     = 1;
+    w->decoded  = 0;
+    w->out_head = 0;
+    w->num_out  = 0;
+    pthread_cond_broadcast(&gop_cond);
+
+    gop_pkts = NULL;
+    gop_len  = 0;
+    gop_size = 0;
+
+    return err;
+}
+
+static int gop_decode(AVPacket *p)
+{
+    int err = 0;
+
+    pthread_mutex_lock(&gop_lock);
+
+    if (gop_len && (!p || p->flags & AV_PKT_FLAG_KEY))
+        err = start_gop();
+
+    if (p) {
+        if (gop_len == gop_size) {
+            int size = gop_size ? 2 * gop_size : 64;
+            AVPacket **pkts = realloc(gop_pkts, size * sizeof(*pkts));
+            if (pkts) {
+                gop_pkts = pkts;
+                gop_size = size;
+            }
+        }
+
+        if (gop_len < gop_size && (gop_pkts[gop_len] = av_packet_clone(p)))
+            gop_len++;
+        else
+            err = -1;
+    }
+
+    err |= output_frames(p ? WAIT_NONE : WAIT_ALL);
+
+    pthread_mutex_unlock(&gop_lock);
+
+    return err;
+}
+
+/* Abandon all GOPs in flight and the one being collected. */
+static void gop_flush(void)
+{
+    int i, j;
+
+    pthread_mutex_lock(&gop_lock);
+
+    flushing = 1;
+    pthread_cond_broadcast(&gop_cond);
+
+    /* Free the queued pictures before waiting, a decoder may need
+       one of their frames to get to the end of its packet. */
+    for (i = 0; i < num_workers; i++) {
+        for (j = 0; j < max_out; j++)
+            av_frame_unref(workers[i].out[j]);
+        workers[i].num_out = 0;
+    }
+
+    for (i = 0; i < num_workers; i++) {
+        struct worker *w = &workers[i];
+
+        while (w->busy && !w->decoded)
+            pthread_cond_wait(&gop_cond, &gop_lock);
+
+        w->busy = 0;
+        w->err = 0;
+    }
+
+    for (i = 0; i < gop_len; i++)
+        av_packet_free(&gop_pkts[i]);
+    gop_len = 0;
+
+    head_seq = next_seq;
+    flushing = 0;
+
+    pthread_mutex_unlock(&gop_lock);
+}
+
+static int open_worker(struct worker *w, AVCodecContext *params,
+                       struct frame_format *ff)
+{
+    int linesize_align[AV_NUM_DATA_POINTERS];
+    int width, height;
+    AVCodec *codec;
+    int i;
+
+    codec = avcodec_find_decoder(params->codec_id);
+    if (!codec) {
+        fprintf(stderr, "Can't find codec %x\n", params->codec_id);
+        return -1;
+    }
+
+    w->avc   = avcodec_alloc_context3(codec);
+    w->frame = av_frame_alloc();
+    w->out   = calloc(max_out, sizeof(*w->out));
+    if (!w->avc || !w->frame || !w->out)
+        return -1;
+
+    for (i = 0; i < max_out; i++)
+        if (!(w->out[i] = av_frame_alloc()))
+            return -1;
+
+    w->avc->width          = params->width;
+    w->avc->height         = params->height;
+    w->avc->pix_fmt        = params->pix_fmt;
+    w->avc->time_base      = params->time_base;
+    w->avc->extradata      = params->extradata;
+    w->avc->extradata_size = params->extradata_size;
+    w->avc->thread_count   = threads;
+    w->avc->thread_type    = FF_THREAD_FRAME | FF_THREAD_SLICE;
+
+    if (codec->capabilities & AV_CODEC_CAP_DR1) {
+        w->avc->opaque      = &pool;
+        w->avc->get_buffer2 = ofbp_lavc_get_buffer2;
+    }
+
+    if (avcodec_open2(w->avc, codec, NULL)) {
+        fprintf(stderr, "gop: error opening decoder\n");
+        return -1;
+    }
+
+    width  = params->width;
+    height = params->height;
+    ff->disp_w = width;
+    ff->disp_h = height;
+
+    avcodec_align_dimensions2(w->avc, &width, &height, linesize_align);
+
+    ff->width  = ALIGN(width, 64);
+    ff->height = height;
+    ff->disp_x = 0;
+    ff->disp_y = 0;
+    ff->pixfmt = w->avc->pix_fmt;
+
+    pool.width  = ff->width;
+    pool.height = ff->height;
+    pool.pixfmt = ff->pixfmt;
+
+    if (pthread_create(&w->thread, NULL, worker_thread, w)) {
+        fprintf(stderr, "gop: error creating thread\n");
+        return -1;
+    }
+
+    return 0;
+}
+
+static void close_worker(struct worker *w)
+{
+    int i;
+
+    if (w->thread)
+        pthread_join(w->thread, NULL);
+    w->thread = 0;
+
+    for (i = 0; i < w->num_pkts; i++)
+        av_packet_free(&w->pkts[i]);
+    free(w->pkts);
+    w->pkts = NULL;
+    w->num_pkts = 0;
+
+    for (i = 0; w->out && i < max_out; i++)
+        av_frame_free(&w->out[i]);
+    free(w->out);
+    w->out = NULL;
+
+    if (w->avc)
+        w->avc->extradata = NULL;
+    avcodec_free_context(&w->avc);
+    av_frame_free(&w->frame);
+
+    w->busy = 0;
+}
+
+static void gop_close(void)
+{
+    int i, j;
+
+    /* Return queued pictures to the pool first, a decoder may be
+       waiting for a free frame. */
+    pthread_mutex_lock(&gop_lock);
+    quit = 1;
+    for (i = 0; i < num_workers; i++)
+        for (j = 0; workers[i].out && j < max_out; j++)
+            av_frame_unref(workers[i].out[j]);
+    pthread_cond_broadcast(&gop_cond);
+    pthread_mutex_unlock(&gop_lock);
+
+    for (i = 0; i < num_workers; i++)
+        close_worker(&workers[i]);
+
+    for (i = 0; i < gop_len; i++)
+        av_packet_free(&gop_pkts[i]);
+    free(gop_pkts);
+    gop_pkts = NULL;
+    gop_len  = 0;
+    gop_size = 0;
+
+    num_workers = 0;
+    next_seq = head_seq = 0;
+    quit = 0;
+}
+
+static int gop_open(const char *name, AVCodecContext *params,
+                    struct frame_format *ff)
+{
+    int i;
+
+    if (name && parse_params(name))
+        return -1;
+
+    if (!num_workers)
+        num_workers = MIN(sysconf(_SC_NPROCESSORS_ONLN), MAX_WORKERS);
+    if (num_workers < 1)
+        num_workers = 1;
+
+    for (i = 0; i < num_workers; i++) {
+        if (open_worker(&workers[i], params, ff)) {
+            gop_close();
+            return -1;
+        }
+    }
+
+    /* Per decoder: its output queue, plus what the decoder holds. */
+    dec_frames = max_out + ofbp_lavc_num_frames(params, workers[0].avc);
+
+    fprintf(stderr, "gop: %d decoders, %d threads each, %u frames each\n",
+            num_workers, threads, dec_frames);
+
+    return 0;
+}
+
+static unsigned gop_num_frames(void)
+{
+    return num_workers * dec_frames;
+}
+
+CODEC(gop) = {
+    .name       = "gop",
+    .open       = gop_open,
+    .decode     = gop_decode,
+    .close      = gop_close,
+    .flush      = gop_flush,
+    .num_frames = gop_num_frames,
+};
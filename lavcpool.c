@@ -0,0 +1,178 @@
+/*
+    Copyright (C) 2026 Mans Rullgard
+
+    Permission is hereby granted, free of charge, to any person
+    obtaining a copy of this software and associated documentation
+    files (the "Software"), to deal in the Software without
+    restriction, including without limitation the rights to use, copy,
+    modify, merge, publish, distribute, sublicense, and/or sell copies
+    of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be
+    included in all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+    EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+    MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+    NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+    HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+    WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+    DEALINGS IN THE SOFTWARE.
+ */
+
+#include <errno.h>
+#include <stdio.h>
+#include <pthread.h>
+#include <libavcodec/avcodec.h>
+#include <libavutil/imgutils.h>
+
+#include "frame.h"
+#include "lavcpool.h"
+#include "util.h"
+
+#define MAX_REFS 16
+
+/* Pool frames currently handed out to a decoder. */
+static int held;
+
+/* Frame threads may ask for buffers concurrently. */
+static pthread_mutex_t pool_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static void release_frame(void *opaque, uint8_t *data)
+{
+    __sync_fetch_and_sub(&held, 1);
+    ofbp_put_frame(opaque);
+}
+
+int ofbp_lavc_held(void)
+{
+    return __sync_fetch_and_add(&held, 0);
+}
+
+/* Give the decoder ordinary buffers from now on. */
+void ofbp_lavc_close(struct lavc_pool *lp)
+{
+    pthread_mutex_lock(&pool_lock);
+    lp->closed = 1;
+    pthread_mutex_unlock(&pool_lock);
+}
+
+/* Serve pictures from the pool again, with a new layout. */
+void ofbp_lavc_reopen(struct lavc_pool *lp, int width, int height,
+                      enum AVPixelFormat pixfmt)
+{
+    pthread_mutex_lock(&pool_lock);
+    lp->width  = width;
+    lp->height = height;
+    lp->pixfmt = pixfmt;
+    lp->req_w  = 0;
+    lp->req_h  = 0;
+    lp->closed = 0;
+    pthread_mutex_unlock(&pool_lock);
+}
+
+/* Hand the decoder a pool frame.  A single AVBufferRef spans all
+   planes and returns the frame to the pool when the last reference
+   to the picture is dropped, whichever thread that happens on.
+   Pictures that don't match the pool's layout get ordinary buffers;
+   ctx->pix_fmt can't be trusted for that, it already follows the
+   stream through a format change. */
+int ofbp_lavc_get_buffer2(AVCodecContext *ctx, AVFrame *pic, int flags)
+{
+    struct lavc_pool *lp = ctx->opaque;
+    struct frame *f;
+    uint8_t *end = NULL;
+    int use;
+    int i;
+
+    pthread_mutex_lock(&pool_lock);
+    if (lp->req_w && (pic->width != lp->req_w || pic->height != lp->req_h))
+        lp->closed = 1;
+    use = !lp->closed && pic->format == lp->pixfmt &&
+        pic->width <= lp->width && pic->height <= lp->height;
+    if (use) {
+        lp->req_w = pic->width;
+        lp->req_h = pic->height;
+    }
+    pthread_mutex_unlock(&pool_lock);
+
+    if (!use)
+        return avcodec_default_get_buffer2(ctx, pic, flags);
+
+    f = lp->get_frame ? lp->get_frame() : ofbp_get_frame();
+    if (!f)
+        return AVERROR(ENOMEM);
+
+    for (i = 0; i < 3 && f->vdata[i]; i++) {
+        int h = i ? lp->height / 2 : lp->height;
+        pic->data[i]     = f->vdata[i];
+        pic->linesize[i] = f->linesize[i];
+        end = MAX(end, f->vdata[i] + f->linesize[i] * h);
+    }
+
+    pic->buf[0] = av_buffer_create(f->vdata[0], end - f->vdata[0],
+                                   release_frame, f, 0);
+    if (!pic->buf[0]) {
+        ofbp_put_frame(f);
+        return AVERROR(ENOMEM);
+    }
+
+    pic->opaque = f;
+    __sync_fetch_and_add(&held, 1);
+
+    return 0;
+}
+
+/* Post a decoded picture for display, copying it into a pool frame
+   first if it was decoded elsewhere. */
+int ofbp_lavc_output(AVFrame *pic, const struct lavc_pool *lp)
+{
+    struct frame *fr = pic->opaque;
+
+    if (!fr) {
+        uint8_t *dst[4] = { 0 };
+        int dst_linesize[4] = { 0 };
+        int i;
+
+        fr = ofbp_get_frame();
+        if (!fr)
+            return -1;
+
+        for (i = 0; i < 3; i++) {
+            dst[i]          = fr->vdata[i];
+            dst_linesize[i] = fr->linesize[i];
+        }
+
+        av_image_copy(dst, dst_linesize, (const uint8_t **)pic->data,
+                      pic->linesize, pic->format,
+                      MIN(pic->width, lp->width),
+                      MIN(pic->height, lp->height));
+    }
+
+    fr->pts = pic->best_effort_timestamp;
+    ofbp_post_frame(fr);
+
+    if (!pic->opaque)
+        ofbp_put_frame(fr);
+
+    return 0;
+}
+
+/* Pictures held by one decoder at once: the reference set, the
+   reorder delay, one in flight per frame thread, and the one being
+   decoded.  Streams that don't signal refs get the H.264 maximum. */
+unsigned ofbp_lavc_num_frames(const AVCodecContext *params,
+                              const AVCodecContext *avc)
+{
+    unsigned refs = params->refs > 0 ? params->refs : MAX_REFS;
+    unsigned delay = params->has_b_frames;
+    unsigned thr = avc->thread_count > 1 ? avc->thread_count : 0;
+
+    fprintf(stderr, "%s: %u refs + %u reorder + %u threads + 1 "
+            "= %u frames\n", avc->codec->name, refs, delay, thr,
+            refs + delay + thr + 1);
+
+    return refs + delay + thr + 1;
+}
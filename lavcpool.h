@@ -0,0 +1,57 @@
+/*
+    Copyright (C) 2026 Mans Rullgard
+
+    Permission is hereby granted, free of charge, to any person
+    obtaining a copy of this software and associated documentation
+    files (the "Software"), to deal in the Software without
+    restriction, including without limitation the rights to use, copy,
+    modify, merge, publish, distribute, sublicense, and/or sell copies
+    of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be
+    included in all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+    EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+    MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+    NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+    HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+    WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+    DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef OFBP_LAVCPOOL_H
+#define OFBP_LAVCPOOL_H
+
+#include <libavcodec/avcodec.h>
+#include "frame.h"
+
+/* Layout of the frames in the pool, for deciding whether a picture
+   can be decoded straight into one.  Point AVCodecContext.opaque at
+   it and set get_buffer2 to ofbp_lavc_get_buffer2.  get_frame, if
+   set, replaces ofbp_get_frame() for decoder buffers.  The pool is
+   closed to the decoder as soon as it asks for a picture of another
+   size than the last one, so that a format change doesn't leave new
+   pictures in a pool that is about to be replaced. */
+struct lavc_pool {
+    int width;
+    int height;
+    enum AVPixelFormat pixfmt;
+    struct frame *(*get_frame)(void);
+    int req_w;
+    int req_h;
+    int closed;
+};
+
+int ofbp_lavc_get_buffer2(AVCodecContext *ctx, AVFrame *pic, int flags);
+int ofbp_lavc_output(AVFrame *pic, const struct lavc_pool *lp);
+int ofbp_lavc_held(void);
+void ofbp_lavc_close(struct lavc_pool *lp);
+void ofbp_lavc_reopen(struct lavc_pool *lp, int width, int height,
+                      enum AVPixelFormat pixfmt);
+unsigned ofbp_lavc_num_frames(const AVCodecContext *params,
+                              const AVCodecContext *avc);
+
+#endif /* OFBP_LAVCPOOL_H */
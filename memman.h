@@ -33,6 +33,11 @@ struct memman {
     int  (*alloc_frames)(struct frame_format *ff, unsigned max_size,
                          struct frame **fr, unsigned *nf);
     void (*free_frames)(struct frame *frames, unsigned nf);
+    void (*release_frame)(struct frame *f);
+    int  (*prefault)(struct frame *frames, unsigned nf);
+    void (*begin_cpu)(struct frame *f);
+    void (*end_cpu)(struct frame *f);
+    unsigned (*slot_size)(const struct frame_format *ff);
 };
 
 extern const struct memman *ofbp_memman_start[];
@@ -0,0 +1,244 @@
+/*
+    Copyright (C) 2026 Mans Rullgard
+
+    Permission is hereby granted, free of charge, to any person
+    obtaining a copy of this software and associated documentation
+    files (the "Software"), to deal in the Software without
+    restriction, including without limitation the rights to use, copy,
+    modify, merge, publish, distribute, sublicense, and/or sell copies
+    of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be
+    included in all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+    EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+    MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+    NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+    HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+    WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+    DEALINGS IN THE SOFTWARE.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "display.h"
+#include "util.h"
+
+#define THUMB_W 160
+#define COLUMNS 8
+
+static char *out_name;
+static int per_frame;
+static unsigned thumb_w, thumb_h;
+static unsigned columns;
+static unsigned stride;
+static uint8_t *sheet;
+static size_t sheet_size;
+static unsigned count;
+
+static const struct pixconv *pixconv;
+static struct frame_format dfmt;
+
+static int parse_params(const char *p)
+{
+    int len;
+
+    while ((len = strcspn(p, " ,;")) > 0) {
+        if (p[1] != '=')
+            goto err;
+
+        switch (p[0]) {
+        case 'o':
+            free(out_name);
+            out_name = strndup(p + 2, len - 2);
+            break;
+        case 'c':
+            columns = strtol(p + 2, NULL, 0);
+            break;
+        case 'w':
+            thumb_w = strtol(p + 2, NULL, 0);
+            break;
+        default:
+            goto err;
+        }
+
+        p += len + !!p[len];
+    }
+
+    if (!columns || thumb_w < 2)
+        goto err;
+
+    return 0;
+err:
+    fprintf(stderr, "null: params: o=file[%%d].ppm c=columns w=width\n");
+    return -1;
+}
+
+/* Number of conversions in a file name pattern, -1 unless they are
+   all integer ones, %d with optional flags and width. */
+static int name_convs(const char *s)
+{
+    int n = 0;
+
+    while ((s = strchr(s, '%'))) {
+        if (*++s == '%') {
+            s++;
+            continue;
+        }
+        s += strspn(s, "-+ #0");
+        s += strspn(s, "0123456789");
+        if (*s != 'd' && *s != 'u')
+            return -1;
+        n++;
+    }
+
+    return n;
+}
+
+static int write_ppm(const char *name, const uint8_t *buf,
+                     unsigned w, unsigned h)
+{
+    FILE *f = fopen(name, "wb");
+
+    if (!f) {
+        perror(name);
+        return -1;
+    }
+
+    fprintf(f, "P6\n%u %u\n255\n", w, h);
+    fwrite(buf, 3 * w, h, f);
+    fclose(f);
+
+    return 0;
+}
+
+static int null_open(const char *name, struct frame_format *dp,
+                     struct frame_format *ff)
+{
+    columns = COLUMNS;
+    thumb_w = THUMB_W;
+    count   = 0;
+
+    if (name && parse_params(name))
+        return -1;
+
+    /* Nothing is rendered, no pixel converter needed. */
+    if (!out_name) {
+        dp->width     = ff->disp_w;
+        dp->height    = ff->disp_h;
+        dp->y_stride  = ff->y_stride;
+        dp->uv_stride = ff->uv_stride;
+        dp->pixfmt    = AV_PIX_FMT_NONE;
+        return 0;
+    }
+
+    per_frame = name_convs(out_name);
+    if (per_frame < 0 || per_frame > 1) {
+        fprintf(stderr, "null: %s: at most one %%d allowed\n", out_name);
+        return -1;
+    }
+    if (per_frame)
+        columns = 1;
+
+    thumb_h = ALIGN(thumb_w * ff->disp_h / ff->disp_w, 2);
+    stride  = 3 * thumb_w * columns;
+
+    dp->width     = thumb_w;
+    dp->height    = thumb_h;
+    dp->y_stride  = stride;
+    dp->uv_stride = 0;
+    dp->pixfmt    = AV_PIX_FMT_RGB24;
+
+    return 0;
+}
+
+static int null_enable(struct frame_format *ff, unsigned flags,
+                       const struct pixconv *pc, struct frame_format *df)
+{
+    pixconv = pc;
+    dfmt = *df;
+
+    if (out_name && !pixconv) {
+        fprintf(stderr, "null: file output needs a pixel converter\n");
+        return -1;
+    }
+
+    return 0;
+}
+
+/* Thumbnails are laid out left to right, top to bottom.  The sheet
+   grows one row of thumbnails at a time.  With one image per frame
+   the sheet is a single thumbnail, reused for every frame. */
+static void null_prepare(struct frame *f)
+{
+    unsigned row = per_frame ? 0 : count / columns;
+    unsigned col = count % columns;
+    size_t size = (size_t)(row + 1) * thumb_h * stride;
+    uint8_t *dst[3] = { 0 };
+
+    if (!out_name)
+        return;
+
+    if (size > sheet_size) {
+        uint8_t *s = realloc(sheet, size);
+        if (!s)
+            return;
+        memset(s + sheet_size, 0, size - sheet_size);
+        sheet = s;
+        sheet_size = size;
+    }
+
+    dst[0] = sheet + (row * thumb_h + dfmt.disp_y) * stride +
+        (col * thumb_w + dfmt.disp_x) * 3;
+
+    pixconv->convert(dst, f->vdata, NULL, NULL);
+}
+
+static void null_show(struct frame *f)
+{
+    char name[1024];
+
+    if (out_name && sheet) {
+        pixconv->finish();
+
+        if (per_frame) {
+            snprintf(name, sizeof(name), out_name, count);
+            write_ppm(name, sheet, thumb_w, thumb_h);
+        }
+    }
+
+    ofbp_put_frame(f);
+    count++;
+}
+
+static void null_close(void)
+{
+    if (out_name && !per_frame && sheet) {
+        unsigned rows = (count + columns - 1) / columns;
+        if (!write_ppm(out_name, sheet, thumb_w * columns, rows * thumb_h))
+            fprintf(stderr, "null: %u frames written to %s\n",
+                    count, out_name);
+    }
+
+    free(sheet);
+    sheet = NULL;
+    sheet_size = 0;
+
+    free(out_name);
+    out_name = NULL;
+}
+
+DISPLAY(null) = {
+    .name    = "null",
+    .open    = null_open,
+    .enable  = null_enable,
+    .prepare = null_prepare,
+    .show    = null_show,
+    .close   = null_close,
+};
@@ -32,6 +32,12 @@
 #include <errno.h>
 #include <pthread.h>
 #include <semaphore.h>
+#include <poll.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
 
 #include <libavformat/avformat.h>
 #include <libavcodec/avcodec.h>
@@ -47,6 +53,51 @@
 #include "pixconv.h"
 
 #define BUFFER_SIZE (64*1024*1024)
+#define MAX_POOL_MB 2047
+#define JITTER_MS 100
+#define POOL_COOLDOWN_MS 2000
+#define STACK_PREFAULT (64*1024)
+#define PREFETCH_PKTS 16
+#define MAX_QUEUE_PKTS 1024
+#define PKT_QUEUE_MS 2000
+#define PKT_QUEUE_BYTES (16*1024*1024)
+
+/* Packets read ahead of the decoder are kept in a ring.  While the
+   demux thread runs it fills the ring up to the high watermark and
+   sleeps until playback drains it to half that; otherwise the ring is
+   just what prefetch() read and read_packet() goes to the file once
+   it runs dry. */
+struct item {
+    const char *name;
+    AVFormatContext *afc;
+    AVStream *st;
+    AVPacket *pkts[MAX_QUEUE_PKTS];
+    int pkt_head;
+    int pkt_count;
+    int pkt_bytes;
+    int demuxing;
+    int demux_stop;
+    int demux_eof;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    pthread_t demux;
+    pthread_t thread;
+};
+
+static unsigned pkt_queue_ms = PKT_QUEUE_MS;
+static unsigned long fper;
+static int lock_mem;
+
+/* Touch the top of the calling thread's stack so it is resident, and
+   with -L locked, before the thread has real work to do. */
+static void
+prefault_stack(void)
+{
+    volatile char buf[STACK_PREFAULT];
+    memset((char *)buf, 0, sizeof(buf));
+    if (lock_mem)
+        mlock((char *)buf, sizeof(buf));
+}
 
 static AVFormatContext *
 open_file(const char *filename)
@@ -59,7 +110,9 @@ open_file(const char *filename)
 
     if (err < 0) {
         fprintf(stderr, "%s: lavf error %d\n", filename, err);
-        exit(1);
+        if (afc)
+            avformat_close_input(&afc);
+        return NULL;
     }
 
     av_dump_format(afc, 0, filename, 0);
@@ -83,6 +136,206 @@ find_stream(AVFormatContext *afc)
     return st;
 }
 
+static void
+push_packet(struct item *it, AVPacket *p)
+{
+    it->pkts[(it->pkt_head + it->pkt_count++) % MAX_QUEUE_PKTS] = p;
+    it->pkt_bytes += p->size;
+}
+
+static AVPacket *
+pop_packet(struct item *it)
+{
+    AVPacket *p = it->pkts[it->pkt_head];
+
+    it->pkt_head = (it->pkt_head + 1) % MAX_QUEUE_PKTS;
+    it->pkt_count--;
+    it->pkt_bytes -= p->size;
+
+    return p;
+}
+
+/* Queue level against the high watermark divided by div. */
+static int
+queue_full(struct item *it, int div)
+{
+    return it->pkt_count == MAX_QUEUE_PKTS ||
+        it->pkt_bytes >= PKT_QUEUE_BYTES / div ||
+        (uint64_t)it->pkt_count * fper >= pkt_queue_ms * 1000000ull / div;
+}
+
+/* Open and probe a playlist item and read its first packets.  Runs on
+   a thread of its own for the next item while the current one plays. */
+static void *
+prefetch(void *p)
+{
+    struct item *it = p;
+    AVPacket pk;
+
+    it->afc = open_file(it->name);
+    if (!it->afc)
+        return NULL;
+
+    it->st = find_stream(it->afc);
+    if (!it->st) {
+        fprintf(stderr, "%s: no video streams found\n", it->name);
+        avformat_close_input(&it->afc);
+        return NULL;
+    }
+
+    while (it->pkt_count < PREFETCH_PKTS && !av_read_frame(it->afc, &pk)) {
+        AVPacket *c;
+        if (pk.stream_index == it->st->index && (c = av_packet_clone(&pk)))
+            push_packet(it, c);
+        av_packet_unref(&pk);
+    }
+
+    return NULL;
+}
+
+static void *
+demux_thread(void *p)
+{
+    struct item *it = p;
+
+    if (lock_mem)
+        prefault_stack();
+
+    pthread_mutex_lock(&it->lock);
+
+    while (!it->demux_stop) {
+        AVPacket *pk;
+        int err;
+
+        if (queue_full(it, 1)) {
+            while (!it->demux_stop && queue_full(it, 2))
+                pthread_cond_wait(&it->cond, &it->lock);
+            continue;
+        }
+
+        pthread_mutex_unlock(&it->lock);
+
+        pk = av_packet_alloc();
+        err = pk ? av_read_frame(it->afc, pk) : AVERROR(ENOMEM);
+        if (!err && pk->stream_index != it->st->index) {
+            av_packet_free(&pk);
+            pthread_mutex_lock(&it->lock);
+            continue;
+        }
+
+        /* Nothing available yet from a non-blocking source, not the
+           end of it. */
+        if (err == AVERROR(EAGAIN)) {
+            av_packet_free(&pk);
+            usleep(10000);
+            pthread_mutex_lock(&it->lock);
+            continue;
+        }
+
+        pthread_mutex_lock(&it->lock);
+
+        if (err) {
+            av_packet_free(&pk);
+            it->demux_eof = 1;
+            pthread_cond_broadcast(&it->cond);
+            break;
+        }
+
+        push_packet(it, pk);
+        pthread_cond_broadcast(&it->cond);
+    }
+
+    pthread_mutex_unlock(&it->lock);
+
+    return NULL;
+}
+
+/* Hand reading the file over to a thread of its own.  Anything else
+   touching it->afc (seeking, scanning) needs stop_demux() first. */
+static int
+start_demux(struct item *it)
+{
+    it->demux_stop = 0;
+    it->demux_eof = 0;
+    pthread_mutex_init(&it->lock, NULL);
+    pthread_cond_init(&it->cond, NULL);
+
+    if (pthread_create(&it->demux, NULL, demux_thread, it)) {
+        pthread_mutex_destroy(&it->lock);
+        pthread_cond_destroy(&it->cond);
+        return -1;
+    }
+
+    it->demuxing = 1;
+
+    return 0;
+}
+
+static void
+stop_demux(struct item *it)
+{
+    if (!it->demuxing)
+        return;
+
+    pthread_mutex_lock(&it->lock);
+    it->demux_stop = 1;
+    pthread_cond_broadcast(&it->cond);
+    pthread_mutex_unlock(&it->lock);
+
+    pthread_join(it->demux, NULL);
+    pthread_mutex_destroy(&it->lock);
+    pthread_cond_destroy(&it->cond);
+    it->demuxing = 0;
+}
+
+static int
+read_packet(struct item *it, AVPacket *pk)
+{
+    AVPacket *p;
+
+    if (it->demuxing) {
+        pthread_mutex_lock(&it->lock);
+        while (!it->pkt_count && !it->demux_eof)
+            pthread_cond_wait(&it->cond, &it->lock);
+        if (!it->pkt_count) {
+            pthread_mutex_unlock(&it->lock);
+            return AVERROR_EOF;
+        }
+        p = pop_packet(it);
+        if (!queue_full(it, 2))
+            pthread_cond_broadcast(&it->cond);
+        pthread_mutex_unlock(&it->lock);
+    } else if (it->pkt_count) {
+        p = pop_packet(it);
+    } else {
+        return av_read_frame(it->afc, pk);
+    }
+
+    av_packet_move_ref(pk, p);
+    av_packet_free(&p);
+
+    return 0;
+}
+
+static void
+drop_packets(struct item *it)
+{
+    while (it->pkt_count) {
+        AVPacket *p = pop_packet(it);
+        av_packet_free(&p);
+    }
+}
+
+static void
+close_item(struct item *it)
+{
+    stop_demux(it);
+    drop_packets(it);
+    if (it->afc)
+        avformat_close_input(&it->afc);
+    memset(it, 0, sizeof(*it));
+}
+
 static const void *
 find_driver(const char *name, const char **param, void *start)
 {
@@ -163,6 +416,32 @@ pixconv_open(const char *name, const struct frame_format *ffmt,
 
 static const struct display *display;
 static const struct timer *timer;
+static const struct codec *codec;
+static const struct memman *memman;
+static const struct pixconv *pixconv;
+static struct frame_format frame_fmt;
+static struct frame_format disp_fmt;
+static pthread_t dispt;
+static int dmabuf_import;
+
+/* Frames must be converted unless they are in the display's own
+   memory, are dmabufs it imports, or the display doesn't look at
+   them. */
+static int
+need_pixconv(const struct frame_format *df)
+{
+    return memman != display->memman && !dmabuf_import &&
+        df->pixfmt != AV_PIX_FMT_NONE;
+}
+
+static char *dispdrv;
+static char *memman_drv;
+static char *pixconv_drv;
+static int pool_size = BUFFER_SIZE;
+static int pool_fixed;
+static unsigned pool_cap;
+static unsigned jitter_ms = JITTER_MS;
+static unsigned play_flags = OFBP_DOUBLE_BUF;
 static struct frame *frames;
 static unsigned num_frames;
 static int free_head;
@@ -170,59 +449,206 @@ static int free_tail;
 static int disp_head = -1;
 static int disp_tail = -1;
 static int disp_count;
+static int pool_resident;
+static int pool_peak;
 
 static pthread_mutex_t disp_lock;
+static pthread_cond_t disp_cond = PTHREAD_COND_INITIALIZER;
+static int disp_max = MIN_FRAMES;
 static sem_t disp_sem;
 static sem_t free_sem;
+static pthread_mutex_t pool_lock = PTHREAD_MUTEX_INITIALIZER;
 
 static int stop;
+static int disp_stop;
+static int disp_preroll;
+static int reconfiguring;
 
 static int noaspect;
 
-struct frame *ofbp_get_frame(void)
+static int scan;
+
+static int accurate;
+static int64_t seek_pts = AV_NOPTS_VALUE;
+static int64_t disp_pts = AV_NOPTS_VALUE;
+static struct timespec seek_start;
+static int seek_pending;
+
+static double speed = 1;
+static int skip_level;
+
+static int reverse;
+static struct frame **rev_frames;
+static int rev_count;
+static int rev_max;
+static int rev_caching;
+
+static int loop;
+static struct frame **loop_frames;
+static int loop_count;
+static int loop_max;
+static int loop_caching;
+static int loop_replaying;
+static unsigned dec_frames;
+static pthread_cond_t loop_cond = PTHREAD_COND_INITIALIZER;
+
+static int input_done;
+
+static void drop_loop_cache(void);
+
+static unsigned
+pool_clock(void)
 {
-    struct frame *f = frames + free_tail;
+    struct timespec ts;
 
-    sem_wait(&free_sem);
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
 
-    if (free_tail < 0) {
+/* The free list is a stack: the most recently released frame, still
+   warm in cache and resident, is handed out first.  Slots at the
+   bottom only come into use when everything above them is busy, and
+   are the first to be trimmed once idle. */
+static struct frame *take_frame(void)
+{
+    struct frame *f;
+
+    pthread_mutex_lock(&pool_lock);
+
+    if (free_head < 0) {
+        pthread_mutex_unlock(&pool_lock);
         fprintf(stderr, "no more buffers\n");
         return NULL;
     }
 
-    free_tail = f->next;
-    frames[free_tail].prev = -1;
-    f->next = -1;
+    f = frames + free_head;
+    free_head = f->prev;
+    frames[free_head].next = -1;
+    f->prev = -1;
     f->refs++;
 
+    if (!f->resident) {
+        f->resident = 1;
+        if (++pool_resident > pool_peak)
+            pool_peak = pool_resident;
+    }
+
+    pthread_mutex_unlock(&pool_lock);
+
+    if (memman->begin_cpu) {
+        memman->begin_cpu(f);
+        f->cpu_access = 1;
+    }
+
     return f;
 }
 
+/* End the CPU access begun by take_frame(), once: frames are posted
+   again by the loop and reverse caches, and dropped without a post. */
+static void
+end_cpu(struct frame *f)
+{
+    if (f->cpu_access) {
+        f->cpu_access = 0;
+        memman->end_cpu(f);
+    }
+}
+
+struct frame *ofbp_get_frame(void)
+{
+    sem_wait(&free_sem);
+    return take_frame();
+}
+
+/* As ofbp_get_frame() but give up after ms milliseconds, for callers
+   that must notice a stop request while waiting. */
+struct frame *ofbp_get_frame_timed(unsigned ms)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_REALTIME, &ts);
+    ts.tv_sec  += ms / 1000;
+    ts.tv_nsec += ms % 1000 * 1000000;
+    if (ts.tv_nsec >= 1000000000) {
+        ts.tv_sec++;
+        ts.tv_nsec -= 1000000000;
+    }
+
+    while (sem_timedwait(&free_sem, &ts))
+        if (errno != EINTR)
+            return NULL;
+
+    return take_frame();
+}
+
 void ofbp_put_frame(struct frame *f)
 {
     unsigned fnum = f->frame_num;
 
+    pthread_mutex_lock(&pool_lock);
+
     if (!--f->refs) {
+        end_cpu(f);
+        f->free_time = pool_clock();
         f->prev = free_head;
         if (free_head != -1)
             frames[free_head].next = fnum;
         free_head = fnum;
         sem_post(&free_sem);
+    } else if (f->refs == 1 && loop_replaying) {
+        pthread_cond_broadcast(&loop_cond);
+    }
+
+    pthread_mutex_unlock(&pool_lock);
+}
+
+/* Give frames idle for longer than the cool-down back to the OS.
+   Free time only grows towards the head, so stop at the first frame
+   still warm. */
+static void
+trim_pool(void)
+{
+    unsigned now;
+    int i;
+
+    if (lock_mem || !memman->release_frame)
+        return;
+
+    pthread_mutex_lock(&pool_lock);
+
+    now = pool_clock();
+    for (i = free_tail; i >= 0; i = frames[i].next) {
+        if (now - frames[i].free_time < POOL_COOLDOWN_MS)
+            break;
+        if (frames[i].resident) {
+            memman->release_frame(&frames[i]);
+            frames[i].resident = 0;
+            pool_resident--;
+        }
     }
+
+    pthread_mutex_unlock(&pool_lock);
 }
 
 static void *
 disp_thread(void *p)
 {
-    AVStream *st = p;
-    unsigned long fper =
-        1000000000ull * st->r_frame_rate.den / st->r_frame_rate.num;
     struct timespec ftime;
     struct timespec tstart, t1, t2;
+    int64_t last_pts = AV_NOPTS_VALUE;
+    struct rusage ru;
+    long minflt = -1, majflt = 0;
     int nf1 = 0, nf2 = 0;
+    int late = 0;
     int sval;
 
-    while (sem_getvalue(&free_sem, &sval), sval && !stop)
+    if (lock_mem)
+        prefault_stack();
+
+    /* Let the decoder fill the pool or the queue first, unless the
+       display is only being restarted for a new format. */
+    while (disp_preroll && (sem_getvalue(&free_sem, &sval), sval) &&
+           disp_count < disp_max && !stop && !disp_stop && !input_done && !scan && !reverse)
         usleep(100000);
 
     timer->start(&tstart);
@@ -230,21 +656,68 @@ disp_thread(void *p)
 
     while (!sem_wait(&disp_sem) && !stop) {
         struct frame *f;
+        int64_t pts;
+        int seeked;
 
         pthread_mutex_lock(&disp_lock);
+        if (disp_tail == -1) {
+            pthread_mutex_unlock(&disp_lock);
+            if (disp_stop)
+                break;
+            continue;
+        }
         f = frames + disp_tail;
         disp_tail = f->next;
         if (disp_tail != -1)
             frames[disp_tail].prev = -1;
         disp_count--;
+        seeked = seek_pending;
+        seek_pending = 0;
+        pthread_cond_signal(&disp_cond);
         pthread_mutex_unlock(&disp_lock);
 
         f->next = -1;
+        pts = f->pts;
+
+        /* Off normal speed, pace by pts.  Fast forward keeps the
+           display rate and drops frames that come too soon after the
+           last one shown; slow motion holds each frame longer. */
+        if ((speed != 1 || reverse) && pts != AV_NOPTS_VALUE &&
+            last_pts != AV_NOPTS_VALUE && !seeked &&
+            (reverse ? pts <= last_pts : pts >= last_pts)) {
+            double delay = llabs(pts - last_pts) * 1000 / speed;
+
+            if (speed > 1 && delay < fper * (1 - 0.5 / speed)) {
+                ofbp_put_frame(f);
+                continue;
+            }
+
+            if (delay > fper)
+                ts_add_ns(&ftime, MIN(delay - fper, 4000000000.0));
+        }
 
         display->prepare(f);
-        timer->wait(&ftime);
+        if (!scan) {
+            /* A display that can see its vblanks paces itself. */
+            int64_t delay = 0;
+            if (display->wait) {
+                timer->read(&t2);
+                delay = (ftime.tv_sec - t2.tv_sec) * 1000000000LL +
+                    ftime.tv_nsec - t2.tv_nsec;
+            }
+            if (!display->wait || display->wait(delay))
+                timer->wait(&ftime);
+        }
         display->show(f);
 
+        disp_pts = last_pts = pts;
+
+        if (seeked) {
+            struct timespec now;
+            clock_gettime(CLOCK_MONOTONIC, &now);
+            fprintf(stderr, "seek: %d ms\n", ts_diff_ms(&now, &seek_start));
+        }
+
         if (++nf1 - nf2 == 50) {
             timer->read(&t2);
             fprintf(stderr, "%3d fps, buffer %3d\r",
@@ -252,14 +725,30 @@ disp_thread(void *p)
                     disp_count);
             nf2 = nf1;
             t1 = t2;
+
+            /* The decoder can't keep up with fast forward: have it
+               skip non-reference frames, then all but keyframes. */
+            if (speed > 1 && late > 5 && skip_level < 2)
+                skip_level++;
+            late = 0;
+
+            trim_pool();
+
+            /* Count page faults from here on, past startup. */
+            if (nf1 == 100 && !getrusage(RUSAGE_SELF, &ru)) {
+                minflt = ru.ru_minflt;
+                majflt = ru.ru_majflt;
+            }
         }
 
         ts_add_ns(&ftime, fper);
 
         timer->read(&t2);
         if (t2.tv_sec > ftime.tv_sec ||
-            (t2.tv_sec == ftime.tv_sec && t2.tv_nsec > ftime.tv_nsec))
+            (t2.tv_sec == ftime.tv_sec && t2.tv_nsec > ftime.tv_nsec)) {
             ftime = t2;
+            late++;
+        }
     }
 
     if (nf1) {
@@ -267,6 +756,10 @@ disp_thread(void *p)
         fprintf(stderr, "%3d fps\n", nf1*1000 / ts_diff_ms(&t2, &tstart));
     }
 
+    if (minflt >= 0 && !getrusage(RUSAGE_SELF, &ru))
+        fprintf(stderr, "steady state page faults: %ld minor, %ld major\n",
+                ru.ru_minflt - minflt, ru.ru_majflt - majflt);
+
     while (disp_tail != -1) {
         struct frame *f = frames + disp_tail;
         disp_tail = f->next;
@@ -280,6 +773,48 @@ void ofbp_post_frame(struct frame *f)
 {
     unsigned fnum = f->frame_num;
 
+    end_cpu(f);
+
+    if (seek_pts != AV_NOPTS_VALUE) {
+        if (f->pts != AV_NOPTS_VALUE && f->pts < seek_pts)
+            return;
+        seek_pts = AV_NOPTS_VALUE;
+    }
+
+    if (rev_caching) {
+        if (rev_count < rev_max) {
+            pthread_mutex_lock(&pool_lock);
+            f->refs++;
+            pthread_mutex_unlock(&pool_lock);
+            rev_frames[rev_count++] = f;
+        }
+        return;
+    }
+
+    if (loop_caching) {
+        if (loop_count < loop_max) {
+            pthread_mutex_lock(&pool_lock);
+            f->refs++;
+            pthread_mutex_unlock(&pool_lock);
+            loop_frames[loop_count++] = f;
+        } else {
+            fprintf(stderr, "Clip longer than %d frames, not caching\n",
+                    loop_max);
+            drop_loop_cache();
+        }
+    }
+
+    /* Hold the decoder back once the display has its jitter allowance
+       queued.  Stop is set from signal handlers, hence the timeout. */
+    pthread_mutex_lock(&disp_lock);
+    while (disp_count >= disp_max && dispt && !stop) {
+        struct timespec ts;
+        clock_gettime(CLOCK_REALTIME, &ts);
+        ts_add_ns(&ts, 100000000);
+        pthread_cond_timedwait(&disp_cond, &disp_lock, &ts);
+    }
+    pthread_mutex_unlock(&disp_lock);
+
     f->prev = disp_head;
     f->next = -1;
 
@@ -293,14 +828,16 @@ void ofbp_post_frame(struct frame *f)
     disp_count++;
     pthread_mutex_unlock(&disp_lock);
 
+    pthread_mutex_lock(&pool_lock);
     f->refs++;
+    pthread_mutex_unlock(&pool_lock);
 
     if (disp_count > 1)
         sem_post(&disp_sem);
 }
 
 static void
-init_frames(struct frame_format *ff)
+set_offsets(struct frame_format *ff)
 {
     const struct pixfmt *pf = ofbp_get_pixfmt(ff->pixfmt);
     int offsets[3];
@@ -319,12 +856,28 @@ init_frames(struct frame_format *ff)
             f->vdata[j] = f->virt[j] + offsets[j];
             f->pdata[j] = f->phys[j] + offsets[j];
         }
+    }
+}
+
+static void
+init_frames(struct frame_format *ff)
+{
+    int i;
+
+    set_offsets(ff);
+
+    for (i = 0; i < num_frames; i++) {
         frames[i].frame_num = i;
         frames[i].next = i + 1;
         frames[i].prev = i - 1;
         frames[i].refs = 0;
+        frames[i].resident = 0;
+        frames[i].cpu_access = 0;
+        frames[i].free_time = 0;
     }
 
+    pool_resident = 0;
+    free_tail = 0;
     free_head = num_frames - 1;
     frames[free_head].next = -1;
     sem_init(&free_sem, 0, num_frames - 1);
@@ -368,83 +921,845 @@ static void set_scale(struct frame_format *df, const struct frame_format *ff,
 
 }
 
-static void
-sigint(int s)
+/* In scan mode, jump from one keyframe straight to the next using the
+   index.  Returns 1 when there are no keyframes left. */
+static int
+next_keyframe(struct item *it, int64_t ts)
 {
-    stop = 1;
-    sem_post(&disp_sem);
-}
+    AVStream *st = it->st;
 
-#define TPVAL(i, sub) (i & (0x100 >> sub)? 255 - (i << sub) : (i << sub))
+    if (!st->nb_index_entries || ts == AV_NOPTS_VALUE)
+        return 0;
 
-static void test_pattern(const struct frame *frames, int num_frames,
-                         const struct frame_format *ff)
+    if (av_index_search_timestamp(st, ts + 1, 0) < 0)
+        return 1;
+
+    drop_packets(it);
+    av_seek_frame(it->afc, st->index, ts + 1, 0);
+
+    return 0;
+}
+
+/* Return frames waiting to be shown to the pool.  The pool itself is
+   left alone. */
+static void
+flush_display(void)
 {
-    const struct pixfmt *p = ofbp_get_pixfmt(ff->pixfmt);
-    int hsub, vsub;
-    int i, j, k;
+    pthread_mutex_lock(&disp_lock);
 
-    if (!p) {
-        fprintf(stderr, "Unknown pixel format %d\n", ff->pixfmt);
-        return;
+    while (disp_tail != -1) {
+        struct frame *f = frames + disp_tail;
+        disp_tail = f->next;
+        f->next = -1;
+        ofbp_put_frame(f);
     }
 
-    hsub = p->hsub[1];
-    vsub = p->vsub[1];
-
-    for (k = 0; k < num_frames; k++) {
-        const struct frame *f = frames + k;
-        uint8_t *y = f->vdata[p->plane[0]] + p->start[0];
-        uint8_t *u = f->vdata[p->plane[1]] + p->start[1];
-        uint8_t *v = f->vdata[p->plane[2]] + p->start[2];
+    disp_head = -1;
+    disp_count = 0;
+    while (!sem_trywait(&disp_sem));
 
-        for (i = 0; i < ff->disp_h; i++)
-            for (j = 0; j < ff->disp_w; j++)
-                y[i*f->linesize[p->plane[0]] + j*p->inc[0]] = 128;
+    seek_pending = 1;
 
-        for (i = 0; i < ff->disp_h >> vsub; i++) {
-            for (j = 0; j < ff->disp_w >> hsub; j++) {
-                u[i*f->linesize[p->plane[1]] + j*p->inc[1]] = TPVAL(i, vsub);
-                v[i*f->linesize[p->plane[2]] + j*p->inc[2]] = TPVAL(j, hsub);
-            }
-        }
-    }
+    pthread_mutex_unlock(&disp_lock);
 }
 
 static int
-speed_test(const char *drv, const char *mem, const char *conv,
-           char *size, unsigned disp_flags)
+seek(struct item *it, int64_t target)
 {
-    const struct pixconv *pixconv = NULL;
-    const struct memman *memman = NULL;
-    struct frame_format dp = { 0 };
-    struct frame_format ff = { 0 };
-    struct timespec t1, t2;
-    unsigned w, h = 0;
-    unsigned n = 1000;
-    unsigned bufsize;
-    char *ss = size;
-    int i, j;
+    AVStream *st = it->st;
 
-    w = strtoul(size, &size, 0);
-    if (*size++)
-        h = strtoul(size, &size, 0);
-    if (*size++)
-        n = strtoul(size, NULL, 0);
+    clock_gettime(CLOCK_MONOTONIC, &seek_start);
 
-    if (!w || !h || !n) {
-        fprintf(stderr, "Invalid size/count '%s'\n", ss);
-        return 1;
+    if (av_seek_frame(it->afc, st->index,
+                      av_rescale_q(target, AV_TIME_BASE_Q, st->time_base),
+                      AVSEEK_FLAG_BACKWARD) < 0) {
+        fprintf(stderr, "seek failed\n");
+        return -1;
     }
 
-    ff.width  = ALIGN(w, 32);
-    ff.height = ALIGN(h, 32);
-    ff.disp_x = 0;
-    ff.disp_y = 0;
-    ff.disp_w = w;
+    drop_packets(it);
+    codec->flush();
+
+    if (loop_caching)
+        drop_loop_cache();
+    flush_display();
+
+    if (accurate)
+        seek_pts = target;
+
+    return 0;
+}
+
+/*
+ * Reverse playback.  Starting from the end, seek back one keyframe at
+ * a time, decode that GOP forward into a cache of pool frames and post
+ * them last to first.  The display thread shows one GOP while the next
+ * one back is being decoded, so the cache gets half the pool.  A GOP
+ * too long for that is reduced to its keyframe, which the display
+ * holds for the length of the GOP.
+ */
+static int
+play_reverse(struct item *it)
+{
+    AVFormatContext *afc = it->afc;
+    AVStream *st = it->st;
+    int64_t end = INT64_MAX;
+    int64_t target;
+    AVPacket **pkts;
+    AVPacket pk;
+    int num_pkts;
+    int warned = 0;
+    int ret = 0;
+    int i;
+
+    rev_max = (num_frames - MIN_FRAMES) / 2;
+    rev_frames = malloc(rev_max * sizeof(*rev_frames));
+    pkts = malloc(rev_max * sizeof(*pkts));
+    if (!rev_frames || !pkts) {
+        ret = -1;
+        goto out;
+    }
+
+    drop_packets(it);
+
+    target = afc->duration;
+    if (afc->start_time != AV_NOPTS_VALUE)
+        target += afc->start_time;
+    target = av_rescale_q(target, AV_TIME_BASE_Q, st->time_base);
+
+    while (!stop &&
+           av_seek_frame(afc, st->index, target, AVSEEK_FLAG_BACKWARD) >= 0) {
+        int64_t start = AV_NOPTS_VALUE;
+        int len = 0;
+
+        num_pkts = 0;
+
+        while (!av_read_frame(afc, &pk)) {
+            int64_t ts = pk.dts != AV_NOPTS_VALUE ? pk.dts : pk.pts;
+
+            if (pk.stream_index != st->index) {
+                av_packet_unref(&pk);
+                continue;
+            }
+
+            if (start == AV_NOPTS_VALUE) {
+                start = ts;
+            } else if (ts >= end || pk.flags & AV_PKT_FLAG_KEY) {
+                av_packet_unref(&pk);
+                break;
+            }
+
+            if (pk.pts != AV_NOPTS_VALUE)
+                pk.pts = av_rescale_q(pk.pts, st->time_base, AV_TIME_BASE_Q);
+
+            if (num_pkts < rev_max)
+                pkts[num_pkts++] = av_packet_clone(&pk);
+            len++;
+            av_packet_unref(&pk);
+        }
+
+        if (start == AV_NOPTS_VALUE || start >= end)
+            break;
+
+        if (len > rev_max) {
+            if (!warned++)
+                fprintf(stderr, "GOP of %d frames exceeds cache of %d, "
+                        "showing keyframes only\n", len, rev_max);
+            len = 1;
+        }
+
+        rev_caching = 1;
+        for (i = 0; i < len && !stop; i++)
+            if (pkts[i] && codec->decode(pkts[i]))
+                ret = -1;
+        codec->decode(NULL);
+        codec->flush();
+        rev_caching = 0;
+
+        while (rev_count) {
+            struct frame *f = rev_frames[--rev_count];
+            ofbp_post_frame(f);
+            ofbp_put_frame(f);
+        }
+
+        for (i = 0; i < num_pkts; i++)
+            av_packet_free(&pkts[i]);
+
+        if (ret)
+            break;
+
+        end = start;
+        target = start - 1;
+    }
+
+out:
+    free(pkts);
+    free(rev_frames);
+    rev_frames = NULL;
+
+    return ret;
+}
+
+static void
+set_speed(double s)
+{
+    if (s <= 0)
+        return;
+
+    speed = s;
+    skip_level = 0;
+    fprintf(stderr, "speed %gx\n", speed);
+}
+
+/* Commands are read from stdin, one per line.  A number seeks to that
+   many seconds from the start of the file, or relative to the frame
+   on screen with a leading + or -.  xN sets the playback speed. */
+static int
+read_command(AVFormatContext *afc, int64_t *target)
+{
+    static char buf[64];
+    static int len;
+    static int eof;
+    struct pollfd pfd = { 0, POLLIN };
+    char *nl, *end;
+    double t;
+    int n;
+
+    nl = memchr(buf, '\n', len);
+
+    if (!nl) {
+        if (eof || poll(&pfd, 1, 0) <= 0)
+            return 0;
+
+        n = read(0, buf + len, sizeof(buf) - len);
+        if (n <= 0) {
+            eof = 1;
+            return 0;
+        }
+
+        len += n;
+        nl = memchr(buf, '\n', len);
+        if (!nl) {
+            if (len == sizeof(buf))
+                len = 0;
+            return 0;
+        }
+    }
+
+    *nl = 0;
+    t = strtod(buf + (buf[0] == 'x'), &end);
+    n = end != buf;
+
+    if (buf[0] == 'x') {
+        if (n)
+            set_speed(t);
+        n = 0;
+    } else if (buf[0] == '+' || buf[0] == '-') {
+        n &= disp_pts != AV_NOPTS_VALUE;
+        *target = disp_pts + t * AV_TIME_BASE;
+    } else {
+        *target = t * AV_TIME_BASE;
+        if (afc->start_time != AV_NOPTS_VALUE)
+            *target += afc->start_time;
+    }
+
+    len -= nl + 1 - buf;
+    memmove(buf, nl + 1, len);
+
+    return n;
+}
+
+static void
+sigint(int s)
+{
+    stop = 1;
+    sem_post(&disp_sem);
+}
+
+#define TPVAL(i, sub) (i & (0x100 >> sub)? 255 - (i << sub) : (i << sub))
+
+static void test_pattern(const struct frame *frames, int num_frames,
+                         const struct frame_format *ff)
+{
+    const struct pixfmt *p = ofbp_get_pixfmt(ff->pixfmt);
+    int hsub, vsub;
+    int i, j, k;
+
+    if (!p) {
+        fprintf(stderr, "Unknown pixel format %d\n", ff->pixfmt);
+        return;
+    }
+
+    hsub = p->hsub[1];
+    vsub = p->vsub[1];
+
+    for (k = 0; k < num_frames; k++) {
+        const struct frame *f = frames + k;
+        uint8_t *y = f->vdata[p->plane[0]] + p->start[0];
+        uint8_t *u = f->vdata[p->plane[1]] + p->start[1];
+        uint8_t *v = f->vdata[p->plane[2]] + p->start[2];
+
+        for (i = 0; i < ff->disp_h; i++)
+            for (j = 0; j < ff->disp_w; j++)
+                y[i*f->linesize[p->plane[0]] + j*p->inc[0]] = 128;
+
+        for (i = 0; i < ff->disp_h >> vsub; i++) {
+            for (j = 0; j < ff->disp_w >> hsub; j++) {
+                u[i*f->linesize[p->plane[1]] + j*p->inc[1]] = TPVAL(i, vsub);
+                v[i*f->linesize[p->plane[2]] + j*p->inc[2]] = TPVAL(j, hsub);
+            }
+        }
+    }
+}
+
+/* Loop mode keeps an extra reference to every frame of a clip that
+   fits in the pool, leaving what the decoder holds and what the
+   display keeps for them to work in.  Later passes post the same
+   frames again without decoding anything. */
+static int
+start_loop_cache(void)
+{
+    loop_max = (int)num_frames - (int)dec_frames - MIN_FRAMES;
+    if (loop_max < 1)
+        return -1;
+
+    loop_frames = malloc(loop_max * sizeof(*loop_frames));
+    if (!loop_frames)
+        return -1;
+
+    loop_count = 0;
+    loop_caching = 1;
+
+    return 0;
+}
+
+static void
+drop_loop_cache(void)
+{
+    while (loop_count)
+        ofbp_put_frame(loop_frames[--loop_count]);
+
+    free(loop_frames);
+    loop_frames = NULL;
+    loop_caching = 0;
+}
+
+static void
+replay_loop(void)
+{
+    struct timespec ts;
+    int i;
+
+    /* Too short to cycle through what the display keeps, decode
+       each pass instead. */
+    if (loop_count <= MIN_FRAMES) {
+        drop_loop_cache();
+        return;
+    }
+
+    fprintf(stderr, "Replaying %d cached frames\n", loop_count);
+
+    pthread_mutex_lock(&pool_lock);
+    loop_replaying = 1;
+
+    while (!stop) {
+        for (i = 0; i < loop_count && !stop; i++) {
+            struct frame *f = loop_frames[i];
+
+            /* Wait until the last pass is done with this frame.  The
+               newest frame posted has no disp_sem post of its own,
+               and in a short loop that may be the one holding this
+               up, so give the display one first.  Stop is set from
+               signal handlers, hence the timeout. */
+            if (f->refs > 1)
+                sem_post(&disp_sem);
+
+            while (f->refs > 1 && !stop) {
+                clock_gettime(CLOCK_REALTIME, &ts);
+                ts_add_ns(&ts, 100000000);
+                pthread_cond_timedwait(&loop_cond, &pool_lock, &ts);
+            }
+
+            pthread_mutex_unlock(&pool_lock);
+            ofbp_post_frame(f);
+            pthread_mutex_lock(&pool_lock);
+        }
+    }
+
+    loop_replaying = 0;
+    pthread_mutex_unlock(&pool_lock);
+}
+
+static int
+same_format(const struct frame_format *a, const struct frame_format *b)
+{
+    return a->width  == b->width  && a->height == b->height &&
+           a->disp_w == b->disp_w && a->disp_h == b->disp_h &&
+           a->disp_x == b->disp_x && a->disp_y == b->disp_y &&
+           a->pixfmt == b->pixfmt;
+}
+
+static int
+start_display(void)
+{
+    disp_head = disp_tail = -1;
+    disp_count = 0;
+    disp_preroll = !reconfiguring;
+    reconfiguring = 0;
+
+    return pthread_create(&dispt, NULL, disp_thread, NULL);
+}
+
+/* Let the display thread show what is queued, then stop it.  The
+   newest frame is never posted to disp_sem, so it takes two extra
+   posts: one for that frame, one to find the queue empty. */
+static void
+stop_display(void)
+{
+    if (!dispt)
+        return;
+
+    disp_stop = 1;
+    sem_post(&disp_sem);
+    sem_post(&disp_sem);
+    pthread_join(dispt, NULL);
+    disp_stop = 0;
+    dispt = 0;
+
+    while (!sem_trywait(&disp_sem));
+}
+
+/* Size the pool for what the decoder holds, plus enough frames to
+   ride out jitter_ms of display stalls, plus what the display itself
+   keeps, plus the frame the free list never hands out.  Frames are
+   counted in the memman's slots, page-aligned if it doesn't say.
+   Decoders that can't say fall back to BUFFER_SIZE.  The -m cap
+   applies either way. */
+static void
+size_pool(const struct frame_format *ff)
+{
+    unsigned dec = codec->num_frames ? codec->num_frames() : 1;
+    uint64_t size = pool_size;
+    unsigned frame_size;
+    unsigned jit;
+
+    if (memman->slot_size) {
+        frame_size = memman->slot_size(ff);
+    } else {
+        struct frame_layout fl;
+        ofbp_frame_layout(&fl, ff->width, ff->height);
+        frame_size = ALIGN(fl.size, sysconf(_SC_PAGESIZE));
+    }
+
+    /* Loop mode leaves this much of the pool to the decoder. */
+    dec_frames = dec;
+
+    /* Decoded frames queued for display stop at the jitter allowance
+       whatever the pool size, -b, loop and reverse included. */
+    jit = fper ? (jitter_ms * 1000000ull + fper - 1) / fper : 0;
+    disp_max = jit + MIN_FRAMES;
+
+    if (!pool_fixed && codec->num_frames) {
+        unsigned n;
+
+        n = dec + jit + MIN_FRAMES + 1;
+        size = (uint64_t)n * frame_size;
+
+        fprintf(stderr, "Pool: %u decoder + %u jitter (%u ms) + %u display "
+                "+ 1 spare = %u frames x %u bytes = %u MB\n",
+                dec, jit, jitter_ms, MIN_FRAMES, n, frame_size,
+                (unsigned)((size + 1048575) >> 20));
+    }
+
+    if (pool_cap && size > (uint64_t)pool_cap << 20) {
+        size = (uint64_t)pool_cap << 20;
+        fprintf(stderr, "Pool: capped at %u MB, %u frames\n", pool_cap,
+                (unsigned)(size / frame_size));
+        if (size / frame_size < dec + MIN_FRAMES + 1)
+            fprintf(stderr, "Pool: cap below decoder needs, "
+                    "expect stalls\n");
+    }
+
+    pool_size = MIN(size, (uint64_t)MAX_POOL_MB << 20);
+}
+
+static int
+lock_frames(void)
+{
+    struct rlimit rl;
+
+    if (!lock_mem)
+        return 0;
+
+    if (!getrlimit(RLIMIT_MEMLOCK, &rl) && rl.rlim_cur != RLIM_INFINITY &&
+        rl.rlim_cur < (rlim_t)pool_size) {
+        fprintf(stderr, "-L: pool needs %u MB locked, RLIMIT_MEMLOCK "
+                "allows %u MB, raise it with ulimit -l\n",
+                (unsigned)(pool_size >> 20), (unsigned)(rl.rlim_cur >> 20));
+        return -1;
+    }
+
+    if (!memman->prefault || memman->prefault(frames, num_frames))
+        fprintf(stderr, "%s: can't prefault frame pool\n", memman->name);
+
+    return 0;
+}
+
+/* A dmabuf memman chosen with -M, if the display can show its frames
+   without a copy. */
+static const struct memman *
+import_memman(void)
+{
+    const struct memman *mm;
+
+    if (!memman_drv || !display->import ||
+        disp_fmt.pixfmt != frame_fmt.pixfmt || display->import(&frame_fmt))
+        return NULL;
+
+    mm = find_driver(memman_drv, NULL, ofbp_memman_start);
+    if (!mm || !(mm->flags & OFBP_DMABUF))
+        return NULL;
+
+    fprintf(stderr, "%s: frames imported by the display\n", mm->name);
+
+    return mm;
+}
+
+/* Set up display, frame pool and pixel converter for frame_fmt and
+   start the display thread. */
+static int
+open_pipeline(void)
+{
+    disp_fmt.pixfmt = frame_fmt.pixfmt;
+    display = display_open(dispdrv, &disp_fmt, &frame_fmt);
+    if (!display)
+        return -1;
+
+    set_scale(&disp_fmt, &frame_fmt, play_flags);
+
+    if (codec->downscale) {
+        struct frame_format sdp = disp_fmt;
+        int err = codec->downscale(&frame_fmt, disp_fmt.disp_w,
+                                   disp_fmt.disp_h);
+
+        if (err < 0)
+            return -1;
+
+        if (err > 0) {
+            display->close();
+            disp_fmt.pixfmt = frame_fmt.pixfmt;
+            display = display_open(dispdrv, &disp_fmt, &frame_fmt);
+            if (!display)
+                return -1;
+            disp_fmt.disp_x = sdp.disp_x;
+            disp_fmt.disp_y = sdp.disp_y;
+            disp_fmt.disp_w = sdp.disp_w;
+            disp_fmt.disp_h = sdp.disp_h;
+        }
+    }
+
+    /* Displays with OFBP_PRIV_MEM can only show frames from their
+       own memman. */
+    if (codec->memman) {
+        if ((display->flags & OFBP_PRIV_MEM) &&
+            codec->memman != display->memman) {
+            fprintf(stderr, "Decoder/display memory mismatch\n");
+            return -1;
+        }
+        memman = codec->memman;
+    } else if ((memman = import_memman())) {
+        dmabuf_import = 1;
+    } else if (display->memman) {
+        if (disp_fmt.pixfmt == frame_fmt.pixfmt) {
+            memman = display->memman;
+        } else if (display->flags & OFBP_PRIV_MEM) {
+            fprintf(stderr, "Decoder/display pixel format mismatch\n");
+            return -1;
+        }
+    }
+
+    if (!memman)
+        memman = find_driver(memman_drv, NULL, ofbp_memman_start);
+    if (!memman)
+        return -1;
+
+    if ((codec->flags & OFBP_PHYS_MEM) && !(memman->flags & OFBP_PHYS_MEM)) {
+        fprintf(stderr, "Incompatible decoder/memman\n");
+        return -1;
+    }
+
+    size_pool(&frame_fmt);
+    if (memman->alloc_frames(&frame_fmt, pool_size, &frames, &num_frames))
+        return -1;
+
+    if (need_pixconv(&disp_fmt)) {
+        pixconv = pixconv_open(pixconv_drv, &frame_fmt, &disp_fmt);
+        if (!pixconv)
+            return -1;
+        if ((pixconv->flags & OFBP_PHYS_MEM) &&
+            !(memman->flags & display->flags & OFBP_PHYS_MEM)) {
+            fprintf(stderr, "Incompatible display/memman/pixconv\n");
+            return -1;
+        }
+    }
+
+    init_frames(&frame_fmt);
+    if (lock_frames())
+        return -1;
+
+    if (display->enable(&frame_fmt, play_flags, pixconv, &disp_fmt))
+        return -1;
+
+    return start_display();
+}
+
+/* Stop the display thread and release everything open_pipeline()
+   set up. */
+static void
+close_pipeline(void)
+{
+    stop_display();
+
+    if (frames) {
+        fprintf(stderr, "Pool: high-water mark %d of %u frames\n",
+                pool_peak, num_frames);
+        memman->free_frames(frames, num_frames);
+    }
+    if (display) display->close();
+    if (pixconv) pixconv->close();
+
+    frames  = NULL;
+    num_frames = 0;
+    memman  = NULL;
+    display = NULL;
+    pixconv = NULL;
+    dmabuf_import = 0;
+}
+
+/*
+ * Called by a decoder before it posts the first frame in a new format.
+ * Frames already queued are shown first.  The display is closed and
+ * opened again for the new format.  The pool is kept if the new frames
+ * fit in it, otherwise it is reallocated; if the display owns it, the
+ * whole pipeline is rebuilt.  Unless the pool is kept, the decoder must
+ * not hold any pool frames.  ff is updated to the pool format, as
+ * alloc_frames does.
+ */
+int ofbp_reconfigure(struct frame_format *ff)
+{
+    int fits = ff->pixfmt == frame_fmt.pixfmt &&
+        ff->width  <= frame_fmt.width &&
+        ff->height <= frame_fmt.height;
+
+    if (same_format(ff, &frame_fmt)) {
+        *ff = frame_fmt;
+        return 0;
+    }
+
+    reconfiguring = 1;
+    stop_display();
+
+    if (loop_frames)
+        drop_loop_cache();
+
+    if (display->memman == memman || (!fits && codec->memman == memman)) {
+        close_pipeline();
+        frame_fmt = *ff;
+        if (open_pipeline())
+            return -1;
+        *ff = frame_fmt;
+        return 0;
+    }
+
+    if (pixconv)
+        pixconv->close();
+    pixconv = NULL;
+    display->close();
+    display = NULL;
+
+    if (fits) {
+        frame_fmt.disp_x = ff->disp_x;
+        frame_fmt.disp_y = ff->disp_y;
+        frame_fmt.disp_w = ff->disp_w;
+        frame_fmt.disp_h = ff->disp_h;
+        set_offsets(&frame_fmt);
+    } else {
+        memman->free_frames(frames, num_frames);
+        frames = NULL;
+        num_frames = 0;
+        frame_fmt = *ff;
+        size_pool(&frame_fmt);
+        if (memman->alloc_frames(&frame_fmt, pool_size, &frames, &num_frames))
+            return -1;
+        init_frames(&frame_fmt);
+        if (lock_frames())
+            return -1;
+    }
+
+    disp_fmt.pixfmt = frame_fmt.pixfmt;
+    display = display_open(dispdrv, &disp_fmt, &frame_fmt);
+    if (!display)
+        return -1;
+
+    set_scale(&disp_fmt, &frame_fmt, play_flags);
+
+    if (dmabuf_import && (!display->import ||
+                          disp_fmt.pixfmt != frame_fmt.pixfmt ||
+                          display->import(&frame_fmt)))
+        dmabuf_import = 0;
+
+    if (need_pixconv(&disp_fmt)) {
+        pixconv = pixconv_open(pixconv_drv, &frame_fmt, &disp_fmt);
+        if (!pixconv)
+            return -1;
+        if ((pixconv->flags & OFBP_PHYS_MEM) &&
+            !(memman->flags & display->flags & OFBP_PHYS_MEM)) {
+            fprintf(stderr, "Incompatible display/memman/pixconv\n");
+            return -1;
+        }
+    }
+
+    if (display->enable(&frame_fmt, play_flags, pixconv, &disp_fmt))
+        return -1;
+
+    *ff = frame_fmt;
+
+    return start_display();
+}
+
+/* Decode one playlist item to the end. */
+static int
+play_item(struct item *it)
+{
+    static const enum AVDiscard skip[] = {
+        AVDISCARD_DEFAULT, AVDISCARD_NONREF, AVDISCARD_NONKEY,
+    };
+    AVStream *st = it->st;
+    AVPacket pk;
+    int cur_skip = 0;
+    int eof = 0;
+    int ret = 0;
+
+    if (reverse)
+        return play_reverse(it);
+
+    if (codec->read) {
+        while (!stop) {
+            int err = codec->read(it->afc);
+            if (err < 0)
+                return -1;
+            if (err)
+                break;
+        }
+        return 0;
+    }
+
+    /* Scanning seeks from packet to packet, keep that synchronous. */
+    if (!scan && start_demux(it))
+        return -1;
+
+    while (!stop && !eof) {
+        int64_t target;
+
+        if (read_command(it->afc, &target) && codec->flush) {
+            stop_demux(it);
+            seek(it, target);
+            if (!scan && start_demux(it)) {
+                ret = -1;
+                break;
+            }
+        }
+
+        if (!scan && codec->discard && skip_level != cur_skip) {
+            cur_skip = skip_level;
+            codec->discard(skip[cur_skip]);
+            fprintf(stderr, "skipping %s frames\n",
+                    cur_skip == 2 ? "non-key" :
+                    cur_skip == 1 ? "non-reference" : "no");
+        }
+
+        if (read_packet(it, &pk))
+            break;
+
+        if (pk.stream_index == st->index) {
+            int key = pk.flags & AV_PKT_FLAG_KEY;
+            int64_t ts = pk.dts != AV_NOPTS_VALUE ? pk.dts : pk.pts;
+
+            if (pk.pts != AV_NOPTS_VALUE)
+                pk.pts = av_rescale_q(pk.pts, st->time_base,
+                                      AV_TIME_BASE_Q);
+            if ((!scan || key || codec->discard) && codec->decode(&pk)) {
+                av_packet_unref(&pk);
+                ret = -1;
+                break;
+            }
+            if (scan && key)
+                eof = next_keyframe(it, ts);
+        }
+        av_packet_unref(&pk);
+    }
+
+    stop_demux(it);
+
+    if (!stop && !ret)
+        codec->decode(NULL);
+
+    return ret;
+}
+
+/* Count data TLB misses in user space for the speed test.  Not all
+   cores expose the event, the test runs without it then. */
+static int
+tlb_counter(void)
+{
+    struct perf_event_attr pe = { 0 };
+
+    pe.type = PERF_TYPE_HW_CACHE;
+    pe.size = sizeof(pe);
+    pe.config = PERF_COUNT_HW_CACHE_DTLB |
+        PERF_COUNT_HW_CACHE_OP_READ << 8 |
+        PERF_COUNT_HW_CACHE_RESULT_MISS << 16;
+    pe.disabled = 1;
+    pe.exclude_kernel = 1;
+    pe.exclude_hv = 1;
+
+    return syscall(__NR_perf_event_open, &pe, 0, -1, -1, 0);
+}
+
+static int
+speed_test(const char *drv, const char *mem, const char *conv,
+           char *size, unsigned disp_flags)
+{
+    struct frame_format dp = { 0 };
+    struct frame_format ff = { 0 };
+    struct timespec t1, t2;
+    unsigned w, h = 0;
+    unsigned n = 1000;
+    unsigned bufsize;
+    uint64_t tlb_misses;
+    char *ss = size;
+    int tlb;
+    int i, j;
+
+    w = strtoul(size, &size, 0);
+    if (*size++)
+        h = strtoul(size, &size, 0);
+    if (*size++)
+        n = strtoul(size, NULL, 0);
+
+    if (!w || !h || !n) {
+        fprintf(stderr, "Invalid size/count '%s'\n", ss);
+        return 1;
+    }
+
+    ff.width  = ALIGN(w, 32);
+    ff.height = ALIGN(h, 32);
+    ff.disp_x = 0;
+    ff.disp_y = 0;
+    ff.disp_w = w;
     ff.disp_h = h;
 
-    dp.pixfmt = ff.pixfmt = PIX_FMT_YUV420P;
+    dp.pixfmt = ff.pixfmt = AV_PIX_FMT_YUV420P;
     display = display_open(drv, &dp, &ff);
     if (!display)
         return 1;
@@ -462,7 +1777,7 @@ speed_test(const char *drv, const char *mem, const char *conv,
     if (memman->alloc_frames(&ff, 0, &frames, &num_frames))
         return 1;
 
-    if (memman != display->memman) {
+    if (need_pixconv(&dp)) {
         pixconv = pixconv_open(conv, &ff, &dp);
         if (!pixconv)
             return 1;
@@ -484,6 +1799,10 @@ speed_test(const char *drv, const char *mem, const char *conv,
 
     signal(SIGINT, sigint);
 
+    tlb = tlb_counter();
+    if (tlb >= 0)
+        ioctl(tlb, PERF_EVENT_IOC_ENABLE, 0);
+
     clock_gettime(CLOCK_REALTIME, &t1);
 
     for (i = 0; i < n && !stop; i++) {
@@ -497,6 +1816,16 @@ speed_test(const char *drv, const char *mem, const char *conv,
     fprintf(stderr, "%d ms, %d fps, read %lld B/s, write %lld B/s\n",
             j, i*1000 / j, 1000LL*i*bufsize / j, 2000LL*i*w*h / j);
 
+    if (tlb >= 0) {
+        ioctl(tlb, PERF_EVENT_IOC_DISABLE, 0);
+        if (read(tlb, &tlb_misses, sizeof(tlb_misses)) ==
+            sizeof(tlb_misses) && i)
+            fprintf(stderr, "dTLB misses %llu, %llu per frame\n",
+                    (unsigned long long)tlb_misses,
+                    (unsigned long long)tlb_misses / i);
+        close(tlb);
+    }
+
     memman->free_frames(frames, num_frames);
     display->close();
     if (pixconv) pixconv->close();
@@ -507,32 +1836,30 @@ speed_test(const char *drv, const char *mem, const char *conv,
 int
 main(int argc, char **argv)
 {
-    AVFormatContext *afc;
-    AVStream *st;
-    AVPacket pk;
-    struct frame_format frame_fmt = { 0 };
-    const struct pixconv *pixconv = NULL;
-    const struct memman *memman = NULL;
-    const struct codec *codec = NULL;
-    struct frame_format dp;
-    int bufsize = BUFFER_SIZE;
-    pthread_t dispt;
-    unsigned flags = OFBP_DOUBLE_BUF;
+    struct item items[2] = { { 0 } };
+    struct item *cur = &items[0];
+    struct item *next = &items[1];
     char *test_param = NULL;
-    char *dispdrv = NULL;
     char *timer_drv = NULL;
-    char *memman_drv = NULL;
-    char *pixconv_drv = NULL;
     char *codec_drv = NULL;
+    const char *codec_param = NULL;
+    int codec_open = 0;
+    int played = 0;
+    int loop_mb = 0;
     int opt;
     int ret = 0;
+    int i;
 
 #define error(n) do { ret = n; goto out; } while (0)
 
-    while ((opt = getopt(argc, argv, "b:d:fFM:P:st:T:v:")) != -1) {
+    while ((opt = getopt(argc, argv, "ab:d:fFj:kLl:m:M:P:q:r:Rst:T:v:")) != -1) {
         switch (opt) {
+        case 'a':
+            accurate = 1;
+            break;
         case 'b':
-            bufsize = strtol(optarg, NULL, 0) * 1048576;
+            pool_size = strtol(optarg, NULL, 0) * 1048576;
+            pool_fixed = 1;
             break;
         case 'd':
             dispdrv = optarg;
@@ -540,7 +1867,23 @@ main(int argc, char **argv)
         case 'F':
             noaspect = 1;
         case 'f':
-            flags |= OFBP_FULLSCREEN;
+            play_flags |= OFBP_FULLSCREEN;
+            break;
+        case 'j':
+            jitter_ms = strtoul(optarg, NULL, 0);
+            break;
+        case 'k':
+            scan = 1;
+            break;
+        case 'L':
+            lock_mem = 1;
+            break;
+        case 'l':
+            loop = 1;
+            loop_mb = strtol(optarg, NULL, 0);
+            break;
+        case 'm':
+            pool_cap = strtoul(optarg, NULL, 0);
             break;
         case 'M':
             memman_drv = optarg;
@@ -548,8 +1891,19 @@ main(int argc, char **argv)
         case 'P':
             pixconv_drv = optarg;
             break;
+        case 'q':
+            pkt_queue_ms = strtoul(optarg, NULL, 0);
+            break;
+        case 'r':
+            speed = strtod(optarg, NULL);
+            if (speed <= 0)
+                speed = 1;
+            break;
+        case 'R':
+            reverse = 1;
+            break;
         case 's':
-            flags &= ~OFBP_DOUBLE_BUF;
+            play_flags &= ~OFBP_DOUBLE_BUF;
             break;
         case 't':
             test_param = optarg;
@@ -567,120 +1921,179 @@ main(int argc, char **argv)
     argv += optind;
 
     if (test_param)
-        return speed_test(dispdrv, memman_drv, pixconv_drv, test_param, flags);
+        return speed_test(dispdrv, memman_drv, pixconv_drv, test_param,
+                          play_flags);
 
     if (argc < 1)
         return 1;
 
-    av_log_set_flags(AV_LOG_SKIP_REPEATED);
-    av_register_all();
-    avcodec_register_all();
+    /* Clip and GOP caches live in the pool, size those by hand. */
+    if (loop || reverse) {
+        pool_size = MAX(pool_size, loop_mb * 1048576);
+        pool_fixed = 1;
+    }
 
-    afc = open_file(argv[0]);
+    /* Lock what is mapped now.  MCL_FUTURE would have every later
+       mapping, the frame pool included, count against RLIMIT_MEMLOCK
+       up front and fail to map for non-root users.  Thread stacks are
+       locked by prefault_stack(), the pool by the memman once it has
+       been checked against the limit in lock_frames(). */
+    if (lock_mem) {
+        struct rlimit rl;
+
+        if (!getrlimit(RLIMIT_MEMLOCK, &rl) && rl.rlim_cur < rl.rlim_max) {
+            rl.rlim_cur = rl.rlim_max;
+            setrlimit(RLIMIT_MEMLOCK, &rl);
+        }
 
-    st = find_stream(afc);
-    if (!st) {
-        fprintf(stderr, "No video streams found.\n");
-        exit(1);
+        if (mlockall(MCL_CURRENT))
+            perror("mlockall");
+        prefault_stack();
     }
 
-    codec = find_driver(codec_drv, NULL, ofbp_codec_start);
+    av_log_set_flags(AV_LOG_SKIP_REPEATED);
+    av_register_all();
+    avcodec_register_all();
+
+    codec = find_driver(codec_drv, &codec_param, ofbp_codec_start);
     if (!codec) {
         fprintf(stderr, "Decoder '%s' not found\n", codec_drv);
         error(1);
     }
 
-    if (codec->open(NULL, st->codec, &frame_fmt)) {
-        fprintf(stderr, "Error opening decoder\n");
+    if (reverse && (codec->read || !codec->flush)) {
+        fprintf(stderr, "Decoder can't play in reverse\n");
         error(1);
     }
 
-    if (!frame_fmt.width) {
-        fprintf(stderr, "Decoder error: frame size not specified\n");
+    timer = timer_open(timer_drv);
+    if (!timer)
         error(1);
-    }
 
-    dp.pixfmt = frame_fmt.pixfmt;
-    display = display_open(dispdrv, &dp, &frame_fmt);
-    if (!display)
-        error(1);
+    pthread_mutex_init(&disp_lock, NULL);
+    sem_init(&disp_sem, 0, 0);
 
-    set_scale(&dp, &frame_fmt, flags);
+    signal(SIGINT, sigint);
 
-    if (display->memman) {
-        if (dp.pixfmt == frame_fmt.pixfmt) {
-            memman = display->memman;
-        } else if (display->flags & OFBP_PRIV_MEM) {
-            fprintf(stderr, "Decoder/display pixel format mismatch\n");
-            error(1);
+    cur->name = argv[0];
+    prefetch(cur);
+
+    for (i = 0; (i < argc || loop) && !stop; i++) {
+        struct frame_format ff = { 0 };
+        int reused = codec_open;
+        struct item *t;
+
+        if (i + 1 < argc || loop) {
+            next->name = argv[(i + 1) % argc];
+            pthread_create(&next->thread, NULL, prefetch, next);
         }
-    }
 
-    if (!memman)
-        memman = find_driver(memman_drv, NULL, ofbp_memman_start);
-    if (!memman)
-        error(1);
+        if (!cur->afc)
+            goto skip;
 
-    if ((codec->flags & OFBP_PHYS_MEM) && !(memman->flags & OFBP_PHYS_MEM)) {
-        fprintf(stderr, "Incompatible decoder/memman\n");
-        error(1);
-    }
+        if (!reused) {
+            if (codec->open(codec_param, cur->st->codec, &ff)) {
+                fprintf(stderr, "Error opening decoder\n");
+                error(1);
+            }
+            codec_open = 1;
 
-    if (memman->alloc_frames(&frame_fmt, bufsize, &frames, &num_frames))
-        error(1);
+            if (!ff.width) {
+                fprintf(stderr, "Decoder error: frame size not specified\n");
+                error(1);
+            }
+        }
 
-    if (memman != display->memman) {
-        pixconv = pixconv_open(pixconv_drv, &frame_fmt, &dp);
-        if (!pixconv)
-            error(1);
-        if ((pixconv->flags & OFBP_PHYS_MEM) &&
-            !(memman->flags & display->flags & OFBP_PHYS_MEM)) {
-            fprintf(stderr, "Incompatible display/memman/pixconv\n");
-            error(1);
+        if (scan && codec->discard)
+            codec->discard(AVDISCARD_NONKEY);
+
+        fper = 1000000000ull * cur->st->r_frame_rate.den /
+            cur->st->r_frame_rate.num;
+
+        /* Keep the display and the frame pool if the new item fits
+           in them, reconfigure if not.  A reused decoder does that
+           itself when its first frame comes out. */
+        if (frames && !reused) {
+            struct frame_format sdp = disp_fmt;
+
+            set_scale(&sdp, &ff, play_flags);
+            if (codec->downscale &&
+                codec->downscale(&ff, sdp.disp_w, sdp.disp_h) < 0)
+                error(1);
+
+            if (!same_format(&ff, &frame_fmt)) {
+                fprintf(stderr, "%s: new format, reconfiguring\n",
+                        cur->name);
+                if (ofbp_reconfigure(&ff))
+                    error(1);
+            }
         }
-    }
 
-    timer = timer_open(timer_drv);
-    if (!timer)
-        error(1);
+        if (!frames) {
+            frame_fmt = ff;
+            if (open_pipeline())
+                error(1);
+        }
 
-    init_frames(&frame_fmt);
+        if (loop && argc == 1 && !i && !scan && !reverse && !codec->memman)
+            start_loop_cache();
 
-    if (display->enable(&frame_fmt, flags, pixconv, &dp))
-        error(1);
+        input_done = 0;
+        if (play_item(cur))
+            stop = 1;
+        input_done = 1;
+        played++;
 
-    pthread_mutex_init(&disp_lock, NULL);
-    sem_init(&disp_sem, 0, 0);
+        if (loop_caching && !stop) {
+            loop_caching = 0;
+            codec->close();
+            codec_open = 0;
+            replay_loop();
+        }
 
-    signal(SIGINT, sigint);
+        /* The pool belongs to the decoder, it can't outlive it. */
+        if (codec->memman)
+            close_pipeline();
 
-    pthread_create(&dispt, NULL, disp_thread, st);
+    skip:
+        if (i + 1 < argc || loop)
+            pthread_join(next->thread, NULL);
 
-    while (!stop && !av_read_frame(afc, &pk)) {
-        if (pk.stream_index == st->index)
-            if (codec->decode(&pk))
-                stop = 1;
-        av_free_packet(&pk);
-    }
+        /* The decoder carries on into the next item if it can take
+           its stream with just a flush. */
+        if (codec_open && (stop || !next->afc || codec->memman ||
+                           !codec->reuse || codec->reuse(next->st->codec))) {
+            codec->close();
+            codec_open = 0;
+        }
 
-    if (!stop) {
-        sem_post(&disp_sem);
-        while (disp_tail != -1)
-            usleep(100000);
+        close_item(cur);
+
+        t = cur;
+        cur = next;
+        next = t;
     }
 
-    stop = 1;
-    sem_post(&disp_sem);
-    pthread_join(dispt, NULL);
+    if (loop_frames)
+        drop_loop_cache();
+    close_pipeline();
+
+    if (!played)
+        ret = 1;
 
 out:
-    if (afc) avformat_close_input(&afc);
+    stop = 1;
 
-    if (codec)   codec->close();
-    if (timer)   timer->close();
-    if (memman)  memman->free_frames(frames, num_frames);
-    if (display) display->close();
-    if (pixconv) pixconv->close();
+    if (codec_open) codec->close();
+    if (loop_frames) drop_loop_cache();
+    close_pipeline();
+
+    if (next->thread)
+        pthread_join(next->thread, NULL);
+    close_item(next);
+    close_item(cur);
+
+    if (timer) timer->close();
 
     return ret;
 }
@@ -27,16 +27,20 @@
 #include "pixfmt.h"
 #include "util.h"
 
+#define CACHE_LINE    64
+#define ALIAS_SIZE    4096
+#define FRAME_COLOURS 8
+
 static const struct pixfmt pixfmt_tab[] = {
     {
-        .fmt   = PIX_FMT_YUV420P,
+        .fmt   = AV_PIX_FMT_YUV420P,
         .plane = { 0, 1, 2 },
         .inc   = { 1, 1, 1 },
         .hsub  = { 0, 1, 1 },
         .vsub  = { 0, 1, 1 },
     },
     {
-        .fmt   = PIX_FMT_YUYV422,
+        .fmt   = AV_PIX_FMT_YUYV422,
         .plane = { 0, 0, 0 },
         .start = { 0, 1, 3 },
         .inc   = { 2, 4, 4 },
@@ -44,7 +48,7 @@ static const struct pixfmt pixfmt_tab[] = {
         .vsub  = { 0, 0, 0 },
     },
     {
-        .fmt   = PIX_FMT_NV12,
+        .fmt   = AV_PIX_FMT_NV12,
         .plane = { 0, 1, 1 },
         .start = { 0, 0, 1 },
         .inc   = { 1, 2, 2 },
@@ -53,7 +57,7 @@ static const struct pixfmt pixfmt_tab[] = {
     },
 };
 
-const struct pixfmt *ofbp_get_pixfmt(enum PixelFormat fmt)
+const struct pixfmt *ofbp_get_pixfmt(enum AVPixelFormat fmt)
 {
     int i;
 
@@ -71,3 +75,34 @@ void ofbp_get_plane_offsets(int offs[3], const struct pixfmt *p,
     for (i = 0; i < 3; i++)
         offs[i] = (y>>p->vsub[i]) * stride[i] + (x>>p->hsub[i]) * p->inc[i];
 }
+
+/*
+ * Layout of a 4:2:0 frame in one buffer: luma, then the two chroma
+ * planes side by side sharing rows of the same stride (or interleaved
+ * NV12 chroma in the same space).  With power-of-two widths every row
+ * of every plane lands in the same cache sets, so strides that are a
+ * multiple of 512 get an extra cache line, and the chroma plane starts
+ * half way into a 4K page relative to luma.  All plane starts are
+ * cache line aligned.  size leaves room for ofbp_frame_colour().
+ */
+void ofbp_frame_layout(struct frame_layout *fl, unsigned w, unsigned h)
+{
+    unsigned half = ALIGN(w / 2, CACHE_LINE);
+
+    fl->stride = 2 * half;
+    if (!(fl->stride % 512))
+        fl->stride += CACHE_LINE;
+
+    fl->uv_offset = ALIGN(fl->stride * h + ALIAS_SIZE / 2, ALIAS_SIZE) -
+        ALIAS_SIZE / 2;
+    fl->v_offset = half;
+    fl->size = fl->uv_offset + fl->stride * h / 2 +
+        ofbp_frame_colour(FRAME_COLOURS - 1);
+}
+
+/* Offset of frame n within its slot, so consecutive frames don't
+   alias each other either. */
+unsigned ofbp_frame_colour(unsigned n)
+{
+    return n % FRAME_COLOURS * (ALIAS_SIZE / FRAME_COLOURS);
+}
@@ -28,7 +28,7 @@
 #include <libavutil/pixfmt.h>
 
 struct pixfmt {
-    enum PixelFormat fmt;
+    enum AVPixelFormat fmt;
     int plane[3];
     int start[3];
     int inc[3];
@@ -36,8 +36,17 @@ struct pixfmt {
     int vsub[3];
 };
 
-const struct pixfmt *ofbp_get_pixfmt(enum PixelFormat fmt);
+struct frame_layout {
+    unsigned stride;
+    unsigned uv_offset;
+    unsigned v_offset;
+    unsigned size;
+};
+
+const struct pixfmt *ofbp_get_pixfmt(enum AVPixelFormat fmt);
 void ofbp_get_plane_offsets(int offs[3], const struct pixfmt *p,
                             int x, int y, const int stride[3]);
+void ofbp_frame_layout(struct frame_layout *fl, unsigned w, unsigned h);
+unsigned ofbp_frame_colour(unsigned n);
 
 #endif
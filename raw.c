@@ -0,0 +1,231 @@
+/*
+    Copyright (C) 2026 Mans Rullgard
+
+    Permission is hereby granted, free of charge, to any person
+    obtaining a copy of this software and associated documentation
+    files (the "Software"), to deal in the Software without
+    restriction, including without limitation the rights to use, copy,
+    modify, merge, publish, distribute, sublicense, and/or sell copies
+    of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be
+    included in all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+    EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+    MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+    NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+    HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+    WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+    DEALINGS IN THE SOFTWARE.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <limits.h>
+#include <sys/uio.h>
+#include <libavformat/avformat.h>
+
+#include "frame.h"
+#include "codec.h"
+#include "pixfmt.h"
+#include "util.h"
+
+struct plane {
+    int index;
+    int row_size;
+    int rows;
+};
+
+static int raw_fd = -1;
+static int y4m;
+static off_t pos;
+static struct plane planes[3];
+static int num_planes;
+static int frame_size;
+static int64_t frame_dur;
+static int64_t frame_num;
+
+static int raw_open(const char *name, AVCodecContext *params,
+                    struct frame_format *ff)
+{
+    const struct pixfmt *pf = ofbp_get_pixfmt(params->pix_fmt);
+    int w = params->width;
+    int h = params->height;
+    int i;
+
+    if (params->codec_id != AV_CODEC_ID_RAWVIDEO) {
+        fprintf(stderr, "raw: input is not raw video\n");
+        return -1;
+    }
+
+    if (!pf) {
+        fprintf(stderr, "raw: unsupported pixel format %d\n",
+                params->pix_fmt);
+        return -1;
+    }
+
+    num_planes = 0;
+    frame_size = 0;
+
+    for (i = 0; i < 3; i++) {
+        struct plane *p = &planes[num_planes];
+
+        if (i && pf->plane[i] == pf->plane[i - 1])
+            continue;
+
+        p->index    = pf->plane[i];
+        p->row_size = (w >> pf->hsub[i]) * pf->inc[i];
+        p->rows     = h >> pf->vsub[i];
+        frame_size += p->row_size * p->rows;
+        num_planes++;
+    }
+
+    if (params->time_base.num && params->time_base.den)
+        frame_dur = av_rescale_q(1, params->time_base, AV_TIME_BASE_Q);
+
+    ff->width  = ALIGN(w, 32);
+    ff->height = h;
+    ff->disp_x = 0;
+    ff->disp_y = 0;
+    ff->disp_w = w;
+    ff->disp_h = h;
+    ff->pixfmt = params->pix_fmt;
+
+    return 0;
+}
+
+/* Skip the YUV4MPEG2 stream header; returns the offset of the first
+   FRAME marker. */
+static off_t y4m_header(int fd)
+{
+    char buf[256];
+    ssize_t n;
+    char *nl;
+    off_t off = 0;
+
+    do {
+        n = pread(fd, buf, sizeof(buf), off);
+        if (n <= 0)
+            return -1;
+        if (!off && memcmp(buf, "YUV4MPEG2 ", 10))
+            return 0;
+        nl = memchr(buf, '\n', n);
+        off += nl ? nl - buf + 1 : n;
+    } while (!nl);
+
+    return off;
+}
+
+static int open_input(AVFormatContext *afc)
+{
+    raw_fd = open(afc->filename, O_RDONLY);
+    if (raw_fd == -1) {
+        perror(afc->filename);
+        return -1;
+    }
+
+    posix_fadvise(raw_fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+
+    pos = y4m_header(raw_fd);
+    if (pos < 0)
+        return -1;
+
+    y4m = pos > 0;
+
+    return 0;
+}
+
+/* Read one frame with a single scatter list of destination rows, so
+   the data lands in the pool frame without any staging buffer. */
+static int read_frame(struct frame *f)
+{
+    struct iovec iov[IOV_MAX];
+    off_t off = pos;
+    ssize_t len = 0;
+    int niov = 0;
+    int i, j;
+
+    for (i = 0; i < num_planes; i++) {
+        const struct plane *p = &planes[i];
+        uint8_t *dst = f->vdata[p->index];
+        int last = i == num_planes - 1;
+
+        for (j = 0; j < p->rows; j++) {
+            iov[niov].iov_base = dst + j * f->linesize[p->index];
+            iov[niov].iov_len  = p->row_size;
+            len += p->row_size;
+
+            if (++niov == IOV_MAX || (last && j == p->rows - 1)) {
+                if (preadv(raw_fd, iov, niov, off) != len)
+                    return -1;
+                off += len;
+                len  = 0;
+                niov = 0;
+            }
+        }
+    }
+
+    return 0;
+}
+
+static int raw_read(AVFormatContext *afc)
+{
+    struct frame *f;
+
+    if (raw_fd == -1 && open_input(afc))
+        return -1;
+
+    if (y4m) {
+        char buf[64];
+        ssize_t n = pread(raw_fd, buf, sizeof(buf), pos);
+        char *nl;
+
+        if (n < 6 || memcmp(buf, "FRAME", 5))
+            return 1;
+
+        nl = memchr(buf, '\n', n);
+        if (!nl)
+            return -1;
+
+        pos += nl - buf + 1;
+    }
+
+    f = ofbp_get_frame();
+    if (!f)
+        return -1;
+
+    if (read_frame(f)) {
+        ofbp_put_frame(f);
+        return 1;
+    }
+
+    pos += frame_size;
+
+    f->pts = frame_num++ * frame_dur;
+    ofbp_post_frame(f);
+    ofbp_put_frame(f);
+
+    return 0;
+}
+
+static void raw_close(void)
+{
+    if (raw_fd != -1)
+        close(raw_fd);
+    raw_fd = -1;
+    frame_num = 0;
+}
+
+CODEC(raw) = {
+    .name   = "raw",
+    .open   = raw_open,
+    .read   = raw_read,
+    .close  = raw_close,
+};
@@ -0,0 +1,224 @@
+/*
+    Copyright (C) 2026 Mans Rullgard
+
+    Permission is hereby granted, free of charge, to any person
+    obtaining a copy of this software and associated documentation
+    files (the "Software"), to deal in the Software without
+    restriction, including without limitation the rights to use, copy,
+    modify, merge, publish, distribute, sublicense, and/or sell copies
+    of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be
+    included in all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+    EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+    MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+    NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+    HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+    WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+    DEALINGS IN THE SOFTWARE.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+
+#include "display.h"
+#include "memman.h"
+#include "shmexport.h"
+#include "util.h"
+
+#define SLOT_ALIGN 4096
+
+static const char *ring_name;
+static int ring_fd = -1;
+static struct ofbp_shm_header *ring;
+static size_t ring_size;
+static struct frame *frames;
+static struct frame *cur_frame;
+
+static int
+export_alloc_frames(struct frame_format *ff, unsigned bufsize,
+                    struct frame **fr, unsigned *nf)
+{
+    int buf_w = ff->width, buf_h = ff->height;
+    unsigned num_frames;
+    unsigned frame_size;
+    unsigned slot_size;
+    unsigned hdr_size;
+    int i, j;
+
+    frame_size = buf_w * buf_h * 3 / 2;
+    slot_size  = ALIGN(frame_size, SLOT_ALIGN);
+    num_frames = MAX(bufsize / slot_size, MIN_FRAMES);
+    hdr_size   = ALIGN(sizeof(*ring) + num_frames * sizeof(ring->slot[0]),
+                       SLOT_ALIGN);
+    ring_size  = hdr_size + (size_t)num_frames * slot_size;
+
+    ring_fd = memfd_create(ring_name, MFD_CLOEXEC | MFD_ALLOW_SEALING);
+    if (ring_fd == -1) {
+        perror("memfd_create");
+        return -1;
+    }
+
+    if (ftruncate(ring_fd, ring_size)) {
+        perror("ftruncate");
+        goto err;
+    }
+
+    fcntl(ring_fd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_SEAL);
+
+    ring = mmap(NULL, ring_size, PROT_READ | PROT_WRITE, MAP_SHARED,
+                ring_fd, 0);
+    if (ring == MAP_FAILED) {
+        perror("mmap");
+        ring = NULL;
+        goto err;
+    }
+
+    frames = calloc(num_frames, sizeof(*frames));
+    if (!frames)
+        goto err;
+
+    ring->magic       = OFBP_SHM_MAGIC;
+    ring->version     = OFBP_SHM_VERSION;
+    ring->data_offset = hdr_size;
+    ring->num_slots   = num_frames;
+    ring->slot_size   = slot_size;
+    ring->width       = ff->width;
+    ring->height      = ff->height;
+    ring->disp_x      = ff->disp_x;
+    ring->disp_y      = ff->disp_y;
+    ring->disp_w      = ff->disp_w;
+    ring->disp_h      = ff->disp_h;
+    ring->pixfmt      = ff->pixfmt;
+    ring->offset[0]   = 0;
+    ring->offset[1]   = buf_w * buf_h;
+    ring->offset[2]   = ring->offset[1] + buf_w / 2;
+
+    for (i = 0; i < 3; i++)
+        ring->linesize[i] = buf_w;
+
+    for (i = 0; i < num_frames; i++) {
+        uint8_t *p = (uint8_t *)ring + hdr_size + i * slot_size;
+
+        for (j = 0; j < 3; j++) {
+            frames[i].virt[j]     = p + ring->offset[j];
+            frames[i].linesize[j] = ring->linesize[j];
+        }
+
+        ring->slot[i].seq = 1;
+        ring->slot[i].pts = INT64_MIN;
+    }
+
+    ff->y_stride  = ff->width;
+    ff->uv_stride = ff->width;
+
+    fprintf(stderr, "shm: %d frames of %d bytes at /proc/%d/fd/%d\n",
+            num_frames, slot_size, getpid(), ring_fd);
+
+    *fr = frames;
+    *nf = num_frames;
+
+    return 0;
+
+err:
+    if (ring)
+        munmap(ring, ring_size);
+    ring = NULL;
+    close(ring_fd);
+    ring_fd = -1;
+    return -1;
+}
+
+static void
+export_free_frames(struct frame *fr, unsigned nf)
+{
+    cur_frame = NULL;
+
+    free(frames);
+    frames = NULL;
+
+    if (ring)
+        munmap(ring, ring_size);
+    ring = NULL;
+
+    close(ring_fd);
+    ring_fd = -1;
+}
+
+static int export_open(const char *name, struct frame_format *dp,
+                       struct frame_format *ff)
+{
+    ring_name = name ? name : "omapfbplay";
+
+    dp->width  = ff->disp_w;
+    dp->height = ff->disp_h;
+    dp->pixfmt = ff->pixfmt;
+
+    return 0;
+}
+
+static int export_enable(struct frame_format *ff, unsigned flags,
+                         const struct pixconv *pc, struct frame_format *df)
+{
+    return 0;
+}
+
+static void export_prepare(struct frame *f)
+{
+}
+
+static void release_frame(struct frame *f)
+{
+    ring->slot[f->frame_num].seq++;
+    __sync_synchronize();
+    ofbp_put_frame(f);
+}
+
+static void export_show(struct frame *f)
+{
+    struct ofbp_shm_slot *s = &ring->slot[f->frame_num];
+    uint32_t head = ring->head + 1;
+
+    s->pts   = f->pts;
+    s->count = head;
+    __sync_synchronize();
+    s->seq++;
+    __sync_synchronize();
+
+    ring->last = f->frame_num;
+    ring->head = head;
+
+    if (cur_frame)
+        release_frame(cur_frame);
+    cur_frame = f;
+}
+
+static void export_close(void)
+{
+}
+
+static const struct memman export_mem = {
+    .name         = "shm",
+    .alloc_frames = export_alloc_frames,
+    .free_frames  = export_free_frames,
+};
+
+DISPLAY(shm) = {
+    .name    = "shm",
+    .flags   = OFBP_PRIV_MEM,
+    .open    = export_open,
+    .enable  = export_enable,
+    .prepare = export_prepare,
+    .show    = export_show,
+    .close   = export_close,
+    .memman  = &export_mem,
+};
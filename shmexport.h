@@ -0,0 +1,71 @@
+/*
+    Copyright (C) 2026 Mans Rullgard
+
+    Permission is hereby granted, free of charge, to any person
+    obtaining a copy of this software and associated documentation
+    files (the "Software"), to deal in the Software without
+    restriction, including without limitation the rights to use, copy,
+    modify, merge, publish, distribute, sublicense, and/or sell copies
+    of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be
+    included in all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+    EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+    MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+    NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+    HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+    WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+    DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef OFBP_SHMEXPORT_H
+#define OFBP_SHMEXPORT_H
+
+#include <stdint.h>
+
+/*
+ * Layout of the frame ring published by the "shm" display driver.
+ *
+ * The ring is a sealed memfd holding this header followed by num_slots
+ * frames of slot_size bytes each, the first at offset data_offset.
+ * Readers open /proc/<pid>/fd/<fd> as printed at startup and map it
+ * read-only.
+ *
+ * Each slot has a sequence counter which is even while the slot holds
+ * a published frame and odd while the frame may be overwritten.  To
+ * read a frame, load seq, read the pixel data, then load seq again.
+ * The copy is valid if both values are equal and even.  The writer
+ * never waits for readers.
+ */
+
+#define OFBP_SHM_MAGIC   0x7062666f     /* "ofbp" */
+#define OFBP_SHM_VERSION 1
+
+struct ofbp_shm_slot {
+    volatile uint32_t seq;
+    volatile uint32_t count;    /* value of head when published */
+    volatile int64_t  pts;      /* microseconds, INT64_MIN if unknown */
+};
+
+struct ofbp_shm_header {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t data_offset;
+    uint32_t num_slots;
+    uint32_t slot_size;
+    uint32_t width, height;
+    uint32_t disp_x, disp_y;
+    uint32_t disp_w, disp_h;
+    int32_t  pixfmt;            /* enum AVPixelFormat */
+    uint32_t offset[3];         /* plane offsets within a slot */
+    uint32_t linesize[3];
+    volatile uint32_t head;     /* number of frames published */
+    volatile uint32_t last;     /* slot holding the newest frame */
+    struct ofbp_shm_slot slot[];
+};
+
+#endif
@@ -0,0 +1,80 @@
+/*
+    Copyright (C) 2026 Mans Rullgard
+
+    Permission is hereby granted, free of charge, to any person
+    obtaining a copy of this software and associated documentation
+    files (the "Software"), to deal in the Software without
+    restriction, including without limitation the rights to use, copy,
+    modify, merge, publish, distribute, sublicense, and/or sell copies
+    of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be
+    included in all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+    EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+    MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+    NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+    HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+    WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+    DEALINGS IN THE SOFTWARE.
+ */
+
+#include <libswscale/swscale.h>
+
+#include "pixconv.h"
+#include "util.h"
+
+static struct SwsContext *sws;
+static int src_stride[3];
+static int dst_stride[3];
+static int src_h;
+
+static int swscale_open(const struct frame_format *ff,
+                        const struct frame_format *df)
+{
+    sws = sws_getContext(ff->disp_w, ff->disp_h, ff->pixfmt,
+                         df->disp_w, df->disp_h, df->pixfmt,
+                         SWS_BILINEAR, NULL, NULL, NULL);
+    if (!sws)
+        return -1;
+
+    src_stride[0] = ff->y_stride;
+    src_stride[1] = ff->uv_stride;
+    src_stride[2] = ff->uv_stride;
+
+    dst_stride[0] = df->y_stride;
+    dst_stride[1] = df->uv_stride;
+    dst_stride[2] = df->uv_stride;
+
+    src_h = ff->disp_h;
+
+    return 0;
+}
+
+static void swscale_convert(uint8_t *vdst[3], uint8_t *vsrc[3],
+                            uint8_t *pdst[3], uint8_t *psrc[3])
+{
+    sws_scale(sws, (const uint8_t *const *)vsrc, src_stride, 0, src_h,
+              vdst, dst_stride);
+}
+
+static void swscale_finish(void)
+{
+}
+
+static void swscale_close(void)
+{
+    sws_freeContext(sws);
+    sws = NULL;
+}
+
+DRIVER(pixconv, swscale) = {
+    .name    = "swscale",
+    .open    = swscale_open,
+    .convert = swscale_convert,
+    .finish  = swscale_finish,
+    .close   = swscale_close,
+};
@@ -25,52 +25,160 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/mman.h>
 
 #include "frame.h"
 #include "memman.h"
+#include "pixfmt.h"
 #include "util.h"
 
+#define DEF_HUGE_PAGE (2*1024*1024)
+
 static uint8_t *frame_buf;
+static size_t frame_buf_size;
+static unsigned slot_size;
+static unsigned huge_page;
+static unsigned num_slots;
+static pthread_t prefault_thread;
+static int prefault_stop;
+
+static unsigned
+huge_page_size(void)
+{
+    unsigned size = 0;
+    char line[128];
+    FILE *f;
+
+    f = fopen("/proc/meminfo", "r");
+    if (!f)
+        return DEF_HUGE_PAGE;
+
+    while (fgets(line, sizeof(line), f))
+        if (sscanf(line, "Hugepagesize: %u kB", &size) == 1)
+            break;
+
+    fclose(f);
+
+    return size ? size * 1024 : DEF_HUGE_PAGE;
+}
+
+/* Page-aligned slots: a slot costs nothing until first written, and
+   can be handed back to the kernel on its own once it has gone idle.
+   With huge pages, start each frame on a huge page if that wastes at
+   most 1/8. */
+static unsigned
+frame_slot(unsigned frame_size, unsigned huge)
+{
+    if (huge && ALIGN(frame_size, huge) - frame_size <= frame_size / 8)
+        return ALIGN(frame_size, huge);
+
+    return ALIGN(frame_size, sysconf(_SC_PAGESIZE));
+}
+
+/* Back the pool with huge pages to spare the small TLBs: hugetlbfs if
+   pages have been reserved, else transparent huge pages on a mapping
+   aligned for them. */
+static void *
+map_huge(size_t *size)
+{
+    size_t len = ALIGN(*size, (size_t)huge_page);
+    uint8_t *p;
+    size_t head;
+
+#ifdef MAP_HUGETLB
+    p = mmap(NULL, len, PROT_READ | PROT_WRITE,
+             MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+    if (p != MAP_FAILED) {
+        fprintf(stderr, "sysmem: using hugetlbfs, %u kB pages\n",
+                huge_page / 1024);
+        *size = len;
+        return p;
+    }
+#endif
+
+#ifdef MADV_HUGEPAGE
+    p = mmap(NULL, len + huge_page, PROT_READ | PROT_WRITE,
+             MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (p == MAP_FAILED)
+        return p;
+
+    head = ALIGN((uintptr_t)p, (uintptr_t)huge_page) - (uintptr_t)p;
+    if (head)
+        munmap(p, head);
+    munmap(p + head + len, huge_page - head);
+    p += head;
+
+    if (!madvise(p, len, MADV_HUGEPAGE))
+        fprintf(stderr, "sysmem: using transparent huge pages\n");
+
+    *size = len;
+    return p;
+#else
+    return MAP_FAILED;
+#endif
+}
 
 static int
-sysmem_alloc_frames(struct frame_format *ff, unsigned bufsize,
-                    struct frame **fr, unsigned *nf)
+alloc_frames(struct frame_format *ff, unsigned bufsize,
+             struct frame **fr, unsigned *nf, int huge)
 {
-    int buf_w = ff->width, buf_h = ff->height;
+    struct frame_layout fl;
     struct frame *frames;
     unsigned num_frames;
     unsigned frame_size;
-    void *fbp;
+    void *fbp = MAP_FAILED;
     int i;
 
-    frame_size = buf_w * buf_h * 3 / 2;
-    num_frames = MAX(bufsize / frame_size, MIN_FRAMES);
-    bufsize = num_frames * frame_size;
+    ofbp_frame_layout(&fl, ff->width, ff->height);
+    frame_size = fl.size;
+    huge_page = huge ? huge_page_size() : 0;
+    slot_size = frame_slot(frame_size, huge_page);
+    num_frames = MAX(bufsize / slot_size, MIN_FRAMES);
+    frame_buf_size = (size_t)num_frames * slot_size;
+    num_slots = num_frames;
 
     fprintf(stderr, "Using %d frame buffers, frame_size=%d\n",
             num_frames, frame_size);
 
-    if (posix_memalign(&fbp, 16, bufsize)) {
-        fprintf(stderr, "Error allocating frame buffers: %d bytes\n", bufsize);
+    if (huge_page)
+        fbp = map_huge(&frame_buf_size);
+
+    if (fbp == MAP_FAILED) {
+        huge_page = 0;
+        fbp = mmap(NULL, frame_buf_size, PROT_READ | PROT_WRITE,
+                   MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    }
+
+    if (fbp == MAP_FAILED) {
+        fprintf(stderr, "Error allocating frame buffers: %zu bytes\n",
+                frame_buf_size);
         return -1;
     }
 
+    if (huge_page && slot_size % huge_page)
+        fprintf(stderr, "sysmem: slots share huge pages, trimming keeps "
+                "up to %u kB of each resident\n", 2 * huge_page / 1024);
+
     frame_buf = fbp;
     frames = calloc(num_frames, sizeof(*frames));
 
     for (i = 0; i < num_frames; i++) {
-        uint8_t *p = frame_buf + i * frame_size;
+        uint8_t *p = frame_buf + i * slot_size + ofbp_frame_colour(i);
 
         frames[i].virt[0] = p;
-        frames[i].virt[1] = p + buf_w * buf_h;
-        frames[i].virt[2] = frames[i].virt[1] + buf_w / 2;
-        frames[i].linesize[0] = ff->width;
-        frames[i].linesize[1] = ff->width;
-        frames[i].linesize[2] = ff->width;
+        frames[i].virt[1] = p + fl.uv_offset;
+        frames[i].virt[2] = frames[i].virt[1] + fl.v_offset;
+        frames[i].linesize[0] = fl.stride;
+        frames[i].linesize[1] = fl.stride;
+        frames[i].linesize[2] = fl.stride;
     }
 
-    ff->y_stride  = ff->width;
-    ff->uv_stride = ff->width;
+    ff->y_stride  = fl.stride;
+    ff->uv_stride = fl.stride;
 
     *fr = frames;
     *nf = num_frames;
@@ -78,15 +186,116 @@ sysmem_alloc_frames(struct frame_format *ff, unsigned bufsize,
     return 0;
 }
 
+static int
+sysmem_alloc_frames(struct frame_format *ff, unsigned bufsize,
+                    struct frame **fr, unsigned *nf)
+{
+    return alloc_frames(ff, bufsize, fr, nf, 1);
+}
+
+static int
+sysmem4k_alloc_frames(struct frame_format *ff, unsigned bufsize,
+                      struct frame **fr, unsigned *nf)
+{
+    return alloc_frames(ff, bufsize, fr, nf, 0);
+}
+
+static unsigned
+sysmem_slot_size(const struct frame_format *ff)
+{
+    struct frame_layout fl;
+
+    ofbp_frame_layout(&fl, ff->width, ff->height);
+    return frame_slot(fl.size, huge_page_size());
+}
+
+static unsigned
+sysmem4k_slot_size(const struct frame_format *ff)
+{
+    struct frame_layout fl;
+
+    ofbp_frame_layout(&fl, ff->width, ff->height);
+    return frame_slot(fl.size, 0);
+}
+
+/* Fault in and lock the slots in the order the pool hands them out,
+   so playback can start while the tail of the pool is still being
+   brought in.  Locking leaves the contents alone, frames already in
+   use are safe. */
+static void *
+prefault_frames(void *p)
+{
+    unsigned i;
+
+    for (i = num_slots; i-- && !prefault_stop;) {
+        if (mlock(frame_buf + (size_t)i * slot_size, slot_size)) {
+            fprintf(stderr, "sysmem: mlock: %s\n", strerror(errno));
+            return NULL;
+        }
+    }
+
+    if (!prefault_stop)
+        fprintf(stderr, "sysmem: %u frame buffers locked\n", num_slots);
+
+    return NULL;
+}
+
+static int
+sysmem_prefault(struct frame *frames, unsigned nf)
+{
+    prefault_stop = 0;
+    if (pthread_create(&prefault_thread, NULL, prefault_frames, NULL)) {
+        prefault_thread = 0;
+        return -1;
+    }
+
+    return 0;
+}
+
 static void
 sysmem_free_frames(struct frame *frames, unsigned nf)
 {
-    free(frame_buf);
+    if (prefault_thread) {
+        prefault_stop = 1;
+        pthread_join(prefault_thread, NULL);
+        prefault_thread = 0;
+    }
+
+    munmap(frame_buf, frame_buf_size);
     frame_buf = NULL;
 }
 
+/* Releasing part of a huge page would split it: give back the huge
+   pages lying wholly inside the slot, keep the ones it shares. */
+static void
+sysmem_release_frame(struct frame *f)
+{
+    uintptr_t start = (uintptr_t)frame_buf + (size_t)f->frame_num * slot_size;
+    uintptr_t end = start + slot_size;
+
+    if (huge_page) {
+        start = ALIGN(start, (uintptr_t)huge_page);
+        end  &= ~(uintptr_t)(huge_page - 1);
+    }
+
+    if (start < end)
+        madvise((void *)start, end - start, MADV_DONTNEED);
+}
+
 DRIVER(memman, sysmem) = {
-    .name         = "system",
-    .alloc_frames = sysmem_alloc_frames,
-    .free_frames  = sysmem_free_frames,
+    .name          = "system",
+    .alloc_frames  = sysmem_alloc_frames,
+    .free_frames   = sysmem_free_frames,
+    .release_frame = sysmem_release_frame,
+    .prefault      = sysmem_prefault,
+    .slot_size     = sysmem_slot_size,
+};
+
+DRIVER(memman, sysmem4k) = {
+    .name          = "system4k",
+    .alloc_frames  = sysmem4k_alloc_frames,
+    .free_frames   = sysmem_free_frames,
+    .release_frame = sysmem_release_frame,
+    .prefault      = sysmem_prefault,
+    .slot_size     = sysmem4k_slot_size,
 };
@@ -42,5 +42,6 @@
 #define OFBP_DOUBLE_BUF 2
 #define OFBP_PHYS_MEM   4
 #define OFBP_PRIV_MEM   8
+#define OFBP_DMABUF     16
 
 #endif /* OFBP_UTIL_H */
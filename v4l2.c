@@ -22,11 +22,14 @@
     DEALINGS IN THE SOFTWARE.
  */
 
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
+#include <errno.h>
 #include <fcntl.h>
+#include <poll.h>
 #include <unistd.h>
 #include <sys/ioctl.h>
 #include <sys/mman.h>
@@ -35,23 +38,24 @@
 #include <linux/fb.h>
 
 #include "display.h"
+#include "dmabuf.h"
 #include "memman.h"
 #include "util.h"
 
 static const unsigned format_map[][3] = {
-    { PIX_FMT_YUV420P, V4L2_PIX_FMT_YUYV,   PIX_FMT_YUYV422 },
-    { PIX_FMT_YUV420P, V4L2_PIX_FMT_NV12,   PIX_FMT_NV12    },
-    { PIX_FMT_YUV420P, V4L2_PIX_FMT_YUV420, PIX_FMT_YUV420P },
-    { PIX_FMT_NV12,    V4L2_PIX_FMT_NV12,   PIX_FMT_NV12    },
-    { PIX_FMT_NONE,    0,                   PIX_FMT_NONE    },
+    { AV_PIX_FMT_YUV420P, V4L2_PIX_FMT_YUYV,   AV_PIX_FMT_YUYV422 },
+    { AV_PIX_FMT_YUV420P, V4L2_PIX_FMT_NV12,   AV_PIX_FMT_NV12    },
+    { AV_PIX_FMT_YUV420P, V4L2_PIX_FMT_YUV420, AV_PIX_FMT_YUV420P },
+    { AV_PIX_FMT_NV12,    V4L2_PIX_FMT_NV12,   AV_PIX_FMT_NV12    },
+    { AV_PIX_FMT_NONE,    0,                   AV_PIX_FMT_NONE    },
 };
 
 static const unsigned (*find_format(const unsigned (*tab)[3],
-                                    enum PixelFormat fmt,
+                                    enum AVPixelFormat fmt,
                                     unsigned vfmt))[3]
 {
     const unsigned (*orig)[3] = tab;
-    while (tab[0][0] != PIX_FMT_NONE) {
+    while (tab[0][0] != AV_PIX_FMT_NONE) {
         if (tab[0][0] == fmt && tab[0][1] == vfmt)
             return tab;
         tab++;
@@ -61,9 +65,12 @@ static const unsigned (*find_format(const unsigned (*tab)[3],
 
 #define NEEDED_CAPS (V4L2_CAP_VIDEO_OUTPUT | V4L2_CAP_STREAMING)
 
-#define NUM_BUFFERS 2
+#define NUM_BUFFERS 3
 
 static int vid_fd = -1;
+static int queue_depth = NUM_BUFFERS;
+static int num_queued;
+static char *dev_name;
 static const struct pixconv *pixconv;
 struct v4l2_format sfmt;
 struct v4l2_crop crop;
@@ -77,6 +84,18 @@ static struct frame *vid_frames;
 static struct vid_buffer *vid_buffers;
 static struct vid_buffer *cur_buf;
 static int num_buffers;
+static int *free_bufs;
+static int num_free;
+
+static const int import_memory[] = {
+    V4L2_MEMORY_DMABUF,
+    V4L2_MEMORY_USERPTR,
+};
+
+static int vid_memory = V4L2_MEMORY_MMAP;
+static int mem_fd = -1;
+static uint8_t *mem_base;
+static size_t mem_size;
 
 #define xioctl(fd, req, param) do {             \
         if (ioctl(fd, req, param) == -1) {      \
@@ -115,9 +134,12 @@ static void free_buffers(struct vid_buffer *vb, int nbufs)
 {
     int i;
 
-    for (i = 0; i < nbufs; i++)
-        if (vb[i].data[0])
+    for (i = 0; i < nbufs; i++) {
+        if (vb[i].buf.memory == V4L2_MEMORY_DMABUF && vb[i].buf.m.fd > 0)
+            close(vb[i].buf.m.fd);
+        else if (vb[i].buf.memory == V4L2_MEMORY_MMAP && vb[i].data[0])
             munmap(vb[i].data[0], vb[i].buf.length);
+    }
 
     free(vb);
 }
@@ -179,6 +201,114 @@ err:
     return NULL;
 }
 
+static void free_mem(void)
+{
+    if (mem_base)
+        munmap(mem_base, mem_size);
+    mem_base = NULL;
+
+    if (mem_fd != -1)
+        close(mem_fd);
+    mem_fd = -1;
+}
+
+static int alloc_mem(size_t size)
+{
+    mem_fd = memfd_create("omapfbplay", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+    if (mem_fd == -1)
+        return -1;
+
+    mem_size = size;
+
+    if (ftruncate(mem_fd, mem_size))
+        goto err;
+
+    fcntl(mem_fd, F_ADD_SEALS, F_SEAL_SHRINK);
+
+    mem_base = mmap(NULL, mem_size, PROT_READ | PROT_WRITE, MAP_SHARED,
+                    mem_fd, 0);
+    if (mem_base == MAP_FAILED) {
+        mem_base = NULL;
+        goto err;
+    }
+
+    return 0;
+err:
+    free_mem();
+    return -1;
+}
+
+/* Hand the device buffers living in our own memory.  The first buffer
+   is queued once as a probe, since some drivers only reject foreign
+   memory at QBUF time; STREAMOFF returns it. */
+static struct vid_buffer *import_buffers(struct v4l2_pix_format *fmt,
+                                         int memory, int *num_bufs)
+{
+    struct v4l2_requestbuffers req = { 0 };
+    struct vid_buffer *vb = NULL;
+    size_t size = mem_size / *num_bufs;
+    int offs[3], stride[3];
+    int i, j;
+
+    if (get_plane_fmt(fmt, offs, stride))
+        return NULL;
+
+    req.count  = *num_bufs;
+    req.type   = V4L2_BUF_TYPE_VIDEO_OUTPUT;
+    req.memory = memory;
+
+    if (ioctl(vid_fd, VIDIOC_REQBUFS, &req) || !req.count)
+        return NULL;
+
+    /* The memory was split for *num_bufs buffers, more won't fit. */
+    if (req.count > *num_bufs) {
+        fprintf(stderr, "V4L2: driver wants %d buffers, have memory "
+                "for %d\n", req.count, *num_bufs);
+        goto err;
+    }
+
+    vb = calloc(req.count, sizeof(*vb));
+    if (!vb)
+        goto err;
+
+    for (i = 0; i < req.count; i++) {
+        struct v4l2_buffer *buf = &vb[i].buf;
+        uint8_t *data = mem_base + i * size;
+
+        buf->index    = i;
+        buf->type     = V4L2_BUF_TYPE_VIDEO_OUTPUT;
+        buf->memory   = memory;
+        buf->length   = size;
+        buf->bytesused = fmt->sizeimage;
+
+        if (memory == V4L2_MEMORY_DMABUF) {
+            buf->m.fd = ofbp_udmabuf(mem_fd, i * size, size);
+            if (buf->m.fd < 0)
+                goto err;
+        } else {
+            buf->m.userptr = (unsigned long)data;
+        }
+
+        for (j = 0; j < 3; j++)
+            vb[i].data[j] = data + offs[j];
+    }
+
+    if (ioctl(vid_fd, VIDIOC_QBUF, &vb[0].buf))
+        goto err;
+
+    i = V4L2_BUF_TYPE_VIDEO_OUTPUT;
+    ioctl(vid_fd, VIDIOC_STREAMOFF, &i);
+
+    *num_bufs = req.count;
+    return vb;
+err:
+    if (vb)
+        free_buffers(vb, req.count);
+    req.count = 0;
+    ioctl(vid_fd, VIDIOC_REQBUFS, &req);
+    return NULL;
+}
+
 static void cleanup(void)
 {
     int i = V4L2_BUF_TYPE_VIDEO_OUTPUT;
@@ -186,6 +316,15 @@ static void cleanup(void)
 
     free_buffers(vid_buffers, num_buffers);
     vid_buffers = NULL;
+    free_mem();
+
+    free(free_bufs);
+    free_bufs = NULL;
+    num_free = 0;
+    num_queued = 0;
+
+    free(dev_name);
+    dev_name = NULL;
 
     close(vid_fd);
     vid_fd = -1;
@@ -193,6 +332,31 @@ static void cleanup(void)
     pixconv = NULL;
 }
 
+static int parse_params(const char *p)
+{
+    int len;
+
+    while ((len = strcspn(p, " ,;")) > 0) {
+        if (p[0] == '/') {
+            dev_name = strndup(p, len);
+        } else if (p[0] == 'b' && p[1] == '=') {
+            queue_depth = strtol(p + 2, NULL, 0);
+        } else {
+            fprintf(stderr, "V4L2: params: /dev/videoN b=buffers\n");
+            return -1;
+        }
+
+        p += len + !!p[len];
+    }
+
+    if (queue_depth < 2) {
+        fprintf(stderr, "V4L2: queue depth must be at least 2\n");
+        return -1;
+    }
+
+    return 0;
+}
+
 static int get_fbsize(struct frame_format *df)
 {
     int fd = open("/dev/fb0", O_RDONLY);
@@ -215,18 +379,21 @@ static int get_fbsize(struct frame_format *df)
     return err;
 }
 
-static int v4l2_open(const char *name, struct frame_format *df,
+static int v4l2_open(const char *param, struct frame_format *df,
                      struct frame_format *ff)
 {
     struct v4l2_capability cap;
     struct v4l2_fmtdesc fmt;
     const unsigned (*pixfmt)[3] = format_map;
+    const char *name = NULL;
     int offs[3], stride[3];
 
-    if (!name)
-        name = "/dev/video1";
+    if (param && parse_params(param))
+        goto err;
+
+    name = dev_name ? dev_name : "/dev/video1";
 
-    vid_fd = open(name, O_RDWR);
+    vid_fd = open(name, O_RDWR | O_NONBLOCK);
     if (vid_fd == -1) {
         perror(name);
         goto err;
@@ -289,19 +456,28 @@ static int v4l2_enable(struct frame_format *ff, unsigned flags,
     int i;
 
     if (!vid_buffers) {
-        int nbufs = NUM_BUFFERS;
+        int nbufs = queue_depth;
         vid_buffers = alloc_buffers(&sfmt.fmt.pix, &nbufs);
         if (!vid_buffers)
             goto err;
         num_buffers = nbufs;
-        for (i = 0; i < num_buffers; i++)
-            xioctl(vid_fd, VIDIOC_QBUF, &vid_buffers[i].buf);
+        free_bufs = malloc(num_buffers * sizeof(*free_bufs));
+        if (!free_bufs)
+            goto err;
+        xioctl(vid_fd, VIDIOC_QBUF, &vid_buffers[0].buf);
+        for (i = 1; i < num_buffers; i++)
+            free_bufs[num_free++] = i;
         pixconv = pc;
     } else {
         struct frame *f = ofbp_get_frame();
         xioctl(vid_fd, VIDIOC_QBUF, &vid_buffers[f->frame_num].buf);
     }
 
+    num_queued = 1;
+
+    fprintf(stderr, "V4L2: queue depth %d\n",
+            pixconv ? num_buffers : queue_depth);
+
     fprintf(stderr, "V4L2: crop %dx%d from %dx%d\n",
             ff->disp_w, ff->disp_h, ff->width, ff->height);
 
@@ -310,7 +486,8 @@ static int v4l2_enable(struct frame_format *ff, unsigned flags,
     crop.c.top    = 0;
     crop.c.width  = ff->disp_w;
     crop.c.height = ff->disp_h;
-    xioctl(vid_fd, VIDIOC_S_CROP, &crop);
+    if (ioctl(vid_fd, VIDIOC_S_CROP, &crop))
+        perror("VIDIOC_S_CROP");
 
     fprintf(stderr, "V4L2: overlay %dx%d @ %d,%d\n",
             df->disp_w, df->disp_h, df->disp_x, df->disp_y);
@@ -322,7 +499,8 @@ static int v4l2_enable(struct frame_format *ff, unsigned flags,
     fmt.fmt.win.w.height     = df->disp_h;
     fmt.fmt.win.field        = V4L2_FIELD_NONE;
     fmt.fmt.win.global_alpha = 255;
-    xioctl(vid_fd, VIDIOC_S_FMT, &fmt);
+    if (ioctl(vid_fd, VIDIOC_S_FMT, &fmt))
+        fprintf(stderr, "V4L2: no overlay, output not positioned\n");
 
     i = V4L2_BUF_TYPE_VIDEO_OUTPUT;
     xioctl(vid_fd, VIDIOC_STREAMON, &i);
@@ -335,16 +513,63 @@ err:
 static int dqbuf(struct v4l2_buffer *buf)
 {
     buf->type   = V4L2_BUF_TYPE_VIDEO_OUTPUT;
-    buf->memory = V4L2_MEMORY_MMAP;
+    buf->memory = vid_memory;
     return ioctl(vid_fd, VIDIOC_DQBUF, buf);
 }
 
+/* Dequeue every buffer the device has finished with.  If block is set
+   and none is ready, wait until one is. */
+static void reclaim(int block)
+{
+    struct v4l2_buffer buf;
+    struct pollfd pfd = { vid_fd, POLLOUT };
+    int n = 0;
+
+    for (;;) {
+        if (dqbuf(&buf)) {
+            if (errno == EAGAIN && block && !n && poll(&pfd, 1, -1) > 0)
+                continue;
+            if (errno == EINTR)
+                continue;
+            break;
+        }
+
+        num_queued--;
+        n++;
+
+        if (pixconv)
+            free_bufs[num_free++] = buf.index;
+        else
+            ofbp_put_frame(&vid_frames[buf.index]);
+    }
+}
+
+static int queue(struct v4l2_buffer *buf, struct frame *f)
+{
+    if (f->pts >= 0) {
+        buf->timestamp.tv_sec  = f->pts / 1000000;
+        buf->timestamp.tv_usec = f->pts % 1000000;
+    } else {
+        buf->timestamp.tv_sec  = 0;
+        buf->timestamp.tv_usec = 0;
+    }
+
+    if (ioctl(vid_fd, VIDIOC_QBUF, buf))
+        return -1;
+
+    num_queued++;
+    return 0;
+}
+
 static void v4l2_prepare(struct frame *f)
 {
     if (pixconv) {
-        struct v4l2_buffer buf;
-        dqbuf(&buf);
-        cur_buf = &vid_buffers[buf.index];
+        reclaim(!num_free);
+        if (!num_free) {
+            cur_buf = NULL;
+            return;
+        }
+        cur_buf = &vid_buffers[free_bufs[--num_free]];
         pixconv->convert(cur_buf->data, f->vdata, NULL, NULL);
     } else if (f->x != crop.c.left || f->y != crop.c.top) {
         crop.c.left   = f->x;
@@ -356,15 +581,16 @@ static void v4l2_prepare(struct frame *f)
 static void v4l2_show(struct frame *f)
 {
     if (pixconv) {
-        pixconv->finish();
-        ioctl(vid_fd, VIDIOC_QBUF, &cur_buf->buf);
-        cur_buf = NULL;
+        if (cur_buf) {
+            pixconv->finish();
+            queue(&cur_buf->buf, f);
+            cur_buf = NULL;
+        }
         ofbp_put_frame(f);
     } else {
-        struct v4l2_buffer buf;
-        ioctl(vid_fd, VIDIOC_QBUF, &vid_buffers[f->frame_num].buf);
-        dqbuf(&buf);
-        ofbp_put_frame(&vid_frames[buf.index]);
+        reclaim(num_queued >= queue_depth);
+        if (queue(&vid_buffers[f->frame_num].buf, f))
+            ofbp_put_frame(f);
     }
 }
 
@@ -400,13 +626,32 @@ static int v4l2_alloc(struct frame_format *ff, unsigned max_mem,
         return -1;
     }
 
-    nframes = MAX(max_mem / frame_size, MIN_FRAMES + 1);
-    fprintf(stderr, "V4L2: memman allocating %d frames\n", nframes);
+    frame_size = MAX(frame_size, sfmt.fmt.pix.sizeimage);
+    nframes = MAX(max_mem / frame_size, MIN_FRAMES + queue_depth);
+
+    vb = NULL;
+
+    if (!alloc_mem((size_t)nframes * ALIGN(frame_size, 4096))) {
+        for (i = 0; i < ARRAY_SIZE(import_memory) && !vb; i++) {
+            vid_memory = import_memory[i];
+            vb = import_buffers(&sfmt.fmt.pix, vid_memory, &nframes);
+        }
+        if (!vb)
+            free_mem();
+    }
+
+    if (!vb) {
+        vid_memory = V4L2_MEMORY_MMAP;
+        vb = alloc_buffers(&sfmt.fmt.pix, &nframes);
+    }
 
-    vb = alloc_buffers(&sfmt.fmt.pix, &nframes);
     if (!vb)
         return -1;
 
+    fprintf(stderr, "V4L2: memman allocated %d %s frames\n", nframes,
+            vid_memory == V4L2_MEMORY_DMABUF  ? "dmabuf"  :
+            vid_memory == V4L2_MEMORY_USERPTR ? "userptr" : "mmap");
+
     frames = calloc(nframes, sizeof(*frames));
     if (!frames)
         goto err;
@@ -419,6 +664,7 @@ static int v4l2_alloc(struct frame_format *ff, unsigned max_mem,
     }
 
     vid_buffers = vb;
+    num_buffers = nframes;
 
     *fr = vid_frames = frames;
     *nf = nframes;
@@ -0,0 +1,685 @@
+/*
+    Copyright (C) 2026 Mans Rullgard
+
+    Permission is hereby granted, free of charge, to any person
+    obtaining a copy of this software and associated documentation
+    files (the "Software"), to deal in the Software without
+    restriction, including without limitation the rights to use, copy,
+    modify, merge, publish, distribute, sublicense, and/or sell copies
+    of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be
+    included in all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+    EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+    MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+    NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+    HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+    WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+    DEALINGS IN THE SOFTWARE.
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+
+#include <linux/videodev2.h>
+#include <libavcodec/avcodec.h>
+
+#include "frame.h"
+#include "codec.h"
+#include "memman.h"
+#include "util.h"
+
+#define NUM_OUT_BUFS 4
+#define MIN_OUT_SIZE (256 * 1024)
+
+static const struct {
+    enum AVCodecID id;
+    uint32_t fourcc;
+} codec_map[] = {
+    { AV_CODEC_ID_H264,       V4L2_PIX_FMT_H264 },
+    { AV_CODEC_ID_H263,       V4L2_PIX_FMT_H263 },
+    { AV_CODEC_ID_MPEG1VIDEO, V4L2_PIX_FMT_MPEG1 },
+    { AV_CODEC_ID_MPEG2VIDEO, V4L2_PIX_FMT_MPEG2 },
+    { AV_CODEC_ID_MPEG4,      V4L2_PIX_FMT_MPEG4 },
+    { AV_CODEC_ID_VC1,        V4L2_PIX_FMT_VC1_ANNEX_G },
+    { AV_CODEC_ID_VP8,        V4L2_PIX_FMT_VP8 },
+};
+
+static const struct {
+    uint32_t fourcc;
+    enum AVPixelFormat pixfmt;
+} pixfmt_map[] = {
+    { V4L2_PIX_FMT_NV12,   AV_PIX_FMT_NV12    },
+    { V4L2_PIX_FMT_YUV420, AV_PIX_FMT_YUV420P },
+};
+
+struct dec_buffer {
+    uint8_t *data;
+    size_t size;
+};
+
+static int dec_fd = -1;
+static char *dev_name;
+static uint32_t in_fourcc;
+
+static struct dec_buffer out_bufs[NUM_OUT_BUFS];
+static int out_free[NUM_OUT_BUFS];
+static int num_out_bufs;
+static int num_out_free;
+static int out_streaming;
+
+static struct v4l2_format cap_fmt;
+static struct dec_buffer *cap_bufs;
+static struct frame *cap_frames;
+static uint8_t *cap_queued;
+static int num_cap_bufs;
+static int num_cap_queued;
+static int cap_streaming;
+static int have_events;
+static int draining;
+
+#define xioctl(fd, req, param) do {             \
+        if (ioctl(fd, req, param) == -1) {      \
+            perror(#req);                       \
+            goto err;                           \
+        }                                       \
+    } while (0)
+
+static int parse_params(const char *p)
+{
+    int len;
+
+    while ((len = strcspn(p, " ,;")) > 0) {
+        if (p[0] == '/') {
+            dev_name = strndup(p, len);
+        } else if (p[0] == 'f' && p[1] == '=' && len == 6) {
+            in_fourcc = v4l2_fourcc(p[2], p[3], p[4], p[5]);
+        } else {
+            fprintf(stderr, "V4L2 dec: params: /dev/videoN f=FOURCC\n");
+            return -1;
+        }
+
+        p += len + !!p[len];
+    }
+
+    return 0;
+}
+
+static int has_format(int fd, int type, uint32_t fourcc)
+{
+    struct v4l2_fmtdesc fmt = { 0 };
+
+    fmt.type = type;
+
+    while (!ioctl(fd, VIDIOC_ENUM_FMT, &fmt)) {
+        if (fmt.pixelformat == fourcc)
+            return 1;
+        fmt.index++;
+    }
+
+    return 0;
+}
+
+static int open_device(const char *name)
+{
+    struct v4l2_capability cap;
+    int fd;
+
+    fd = open(name, O_RDWR | O_NONBLOCK);
+    if (fd == -1)
+        return -1;
+
+    if (ioctl(fd, VIDIOC_QUERYCAP, &cap) ||
+        !(cap.capabilities & V4L2_CAP_STREAMING) ||
+        !(cap.capabilities & V4L2_CAP_VIDEO_M2M) ||
+        !has_format(fd, V4L2_BUF_TYPE_VIDEO_OUTPUT, in_fourcc)) {
+        close(fd);
+        return -1;
+    }
+
+    fprintf(stderr, "V4L2 dec: %s driver=%s card=%s\n",
+            name, cap.driver, cap.card);
+
+    return fd;
+}
+
+static int find_device(void)
+{
+    char name[32];
+    int i;
+
+    if (dev_name) {
+        dec_fd = open_device(dev_name);
+        return dec_fd;
+    }
+
+    for (i = 0; i < 64; i++) {
+        snprintf(name, sizeof(name), "/dev/video%d", i);
+        dec_fd = open_device(name);
+        if (dec_fd != -1)
+            break;
+    }
+
+    return dec_fd;
+}
+
+static void free_buffers(struct dec_buffer *b, int n)
+{
+    int i;
+
+    for (i = 0; i < n; i++)
+        if (b[i].data)
+            munmap(b[i].data, b[i].size);
+}
+
+static int map_buffers(int type, struct dec_buffer *b, int n)
+{
+    struct v4l2_buffer buf;
+    int i;
+
+    for (i = 0; i < n; i++) {
+        memset(&buf, 0, sizeof(buf));
+        buf.index  = i;
+        buf.type   = type;
+        buf.memory = V4L2_MEMORY_MMAP;
+
+        xioctl(dec_fd, VIDIOC_QUERYBUF, &buf);
+
+        b[i].size = buf.length;
+        b[i].data = mmap(NULL, buf.length, PROT_READ | PROT_WRITE,
+                         MAP_SHARED, dec_fd, buf.m.offset);
+        if (b[i].data == MAP_FAILED) {
+            b[i].data = NULL;
+            perror("mmap");
+            goto err;
+        }
+    }
+
+    return 0;
+err:
+    free_buffers(b, i);
+    return -1;
+}
+
+static void dec_close(void)
+{
+    int i;
+
+    if (dec_fd != -1) {
+        i = V4L2_BUF_TYPE_VIDEO_OUTPUT;
+        ioctl(dec_fd, VIDIOC_STREAMOFF, &i);
+        i = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+        ioctl(dec_fd, VIDIOC_STREAMOFF, &i);
+    }
+
+    free_buffers(out_bufs, num_out_bufs);
+    memset(out_bufs, 0, sizeof(out_bufs));
+    num_out_bufs = 0;
+    num_out_free = 0;
+    out_streaming = 0;
+    cap_streaming = 0;
+
+    if (dec_fd != -1)
+        close(dec_fd);
+    dec_fd = -1;
+
+    free(dev_name);
+    dev_name = NULL;
+}
+
+static int dec_open(const char *param, AVCodecContext *cc,
+                    struct frame_format *ff)
+{
+    struct v4l2_event_subscription sub = { 0 };
+    struct v4l2_requestbuffers req = { 0 };
+    struct v4l2_format fmt = { 0 };
+    int i;
+
+    for (i = 0; i < ARRAY_SIZE(codec_map); i++)
+        if (codec_map[i].id == cc->codec_id)
+            in_fourcc = codec_map[i].fourcc;
+
+    if (param && parse_params(param))
+        goto err;
+
+    if (!in_fourcc) {
+        fprintf(stderr, "V4L2 dec: unsupported codec %d\n", cc->codec_id);
+        goto err;
+    }
+
+    if (find_device() == -1) {
+        fprintf(stderr, "V4L2 dec: no decoder for %.4s\n",
+                (char *)&in_fourcc);
+        goto err;
+    }
+
+    sub.type = V4L2_EVENT_SOURCE_CHANGE;
+    have_events = !ioctl(dec_fd, VIDIOC_SUBSCRIBE_EVENT, &sub);
+
+    fmt.type                 = V4L2_BUF_TYPE_VIDEO_OUTPUT;
+    fmt.fmt.pix.pixelformat  = in_fourcc;
+    fmt.fmt.pix.width        = cc->width;
+    fmt.fmt.pix.height       = cc->height;
+    fmt.fmt.pix.sizeimage    = MAX(cc->width * cc->height, MIN_OUT_SIZE);
+    xioctl(dec_fd, VIDIOC_S_FMT, &fmt);
+
+    req.count  = NUM_OUT_BUFS;
+    req.type   = V4L2_BUF_TYPE_VIDEO_OUTPUT;
+    req.memory = V4L2_MEMORY_MMAP;
+    xioctl(dec_fd, VIDIOC_REQBUFS, &req);
+
+    num_out_bufs = MIN(req.count, NUM_OUT_BUFS);
+    if (map_buffers(V4L2_BUF_TYPE_VIDEO_OUTPUT, out_bufs, num_out_bufs)) {
+        num_out_bufs = 0;
+        goto err;
+    }
+
+    for (i = 0; i < num_out_bufs; i++)
+        out_free[num_out_free++] = i;
+
+    for (i = 0; i < ARRAY_SIZE(pixfmt_map); i++) {
+        cap_fmt.type                = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+        cap_fmt.fmt.pix.pixelformat = pixfmt_map[i].fourcc;
+        cap_fmt.fmt.pix.width       = cc->width;
+        cap_fmt.fmt.pix.height      = cc->height;
+        if (!ioctl(dec_fd, VIDIOC_S_FMT, &cap_fmt) &&
+            cap_fmt.fmt.pix.pixelformat == pixfmt_map[i].fourcc)
+            break;
+    }
+
+    if (i == ARRAY_SIZE(pixfmt_map)) {
+        fprintf(stderr, "V4L2 dec: no supported output format\n");
+        goto err;
+    }
+
+    ff->width     = cap_fmt.fmt.pix.width;
+    ff->height    = cap_fmt.fmt.pix.height;
+    ff->disp_x    = 0;
+    ff->disp_y    = 0;
+    ff->disp_w    = cc->width;
+    ff->disp_h    = cc->height;
+    ff->pixfmt    = pixfmt_map[i].pixfmt;
+    ff->y_stride  = cap_fmt.fmt.pix.bytesperline;
+    ff->uv_stride = ff->pixfmt == AV_PIX_FMT_NV12 ?
+        ff->y_stride : ff->y_stride / 2;
+
+    fprintf(stderr, "V4L2 dec: %.4s -> %.4s %dx%d\n",
+            (char *)&in_fourcc, (char *)&cap_fmt.fmt.pix.pixelformat,
+            ff->width, ff->height);
+
+    return 0;
+err:
+    dec_close();
+    return -1;
+}
+
+static int queue_capture(struct frame *f)
+{
+    struct v4l2_buffer buf = { 0 };
+
+    buf.index  = f->frame_num;
+    buf.type   = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    buf.memory = V4L2_MEMORY_MMAP;
+
+    if (ioctl(dec_fd, VIDIOC_QBUF, &buf)) {
+        perror("VIDIOC_QBUF");
+        ofbp_put_frame(f);
+        return -1;
+    }
+
+    cap_queued[buf.index] = 1;
+    num_cap_queued++;
+
+    return 0;
+}
+
+/* Keep the decoder supplied with capture buffers, leaving enough
+   frames outside it for the display to make progress. */
+static void fill_capture(void)
+{
+    while (cap_streaming && num_cap_queued < num_cap_bufs - MIN_FRAMES)
+        if (queue_capture(ofbp_get_frame()))
+            break;
+}
+
+static int start_capture(void)
+{
+    int type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    int i;
+
+    if (cap_streaming) {
+        ioctl(dec_fd, VIDIOC_STREAMOFF, &type);
+        cap_streaming = 0;
+    }
+
+    xioctl(dec_fd, VIDIOC_STREAMON, &type);
+    cap_streaming = 1;
+
+    for (i = 0; i < num_cap_bufs; i++) {
+        if (cap_queued[i]) {
+            cap_queued[i] = 0;
+            num_cap_queued--;
+            queue_capture(&cap_frames[i]);
+        }
+    }
+
+    fill_capture();
+
+    return 0;
+err:
+    return -1;
+}
+
+static int source_change(void)
+{
+    struct v4l2_format fmt = { 0 };
+    struct v4l2_pix_format *pix = &fmt.fmt.pix;
+
+    fmt.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    xioctl(dec_fd, VIDIOC_G_FMT, &fmt);
+
+    if (pix->pixelformat  != cap_fmt.fmt.pix.pixelformat  ||
+        pix->bytesperline != cap_fmt.fmt.pix.bytesperline ||
+        pix->sizeimage    >  cap_bufs[0].size) {
+        fprintf(stderr, "V4L2 dec: unsupported format change to "
+                "%.4s %dx%d\n", (char *)&pix->pixelformat,
+                pix->width, pix->height);
+        return -1;
+    }
+
+    return start_capture();
+err:
+    return -1;
+}
+
+static int handle_event(void)
+{
+    struct v4l2_event ev;
+
+    while (!ioctl(dec_fd, VIDIOC_DQEVENT, &ev))
+        if (ev.type == V4L2_EVENT_SOURCE_CHANGE &&
+            (ev.u.src_change.changes & V4L2_EVENT_SRC_CH_RESOLUTION))
+            if (source_change())
+                return -1;
+
+    return 0;
+}
+
+static void dequeue_capture(void)
+{
+    struct v4l2_buffer buf;
+    struct frame *f;
+
+    for (;;) {
+        memset(&buf, 0, sizeof(buf));
+        buf.type   = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+        buf.memory = V4L2_MEMORY_MMAP;
+
+        if (ioctl(dec_fd, VIDIOC_DQBUF, &buf)) {
+            if (errno == EPIPE)
+                draining = 0;
+            break;
+        }
+
+        if (buf.flags & V4L2_BUF_FLAG_LAST)
+            draining = 0;
+
+        f = &cap_frames[buf.index];
+        cap_queued[buf.index] = 0;
+        num_cap_queued--;
+
+        if (buf.bytesused && !(buf.flags & V4L2_BUF_FLAG_ERROR)) {
+            f->pts = (int64_t)buf.timestamp.tv_sec * 1000000 +
+                buf.timestamp.tv_usec;
+            ofbp_post_frame(f);
+        }
+
+        ofbp_put_frame(f);
+    }
+}
+
+static void dequeue_output(void)
+{
+    struct v4l2_buffer buf;
+
+    for (;;) {
+        memset(&buf, 0, sizeof(buf));
+        buf.type   = V4L2_BUF_TYPE_VIDEO_OUTPUT;
+        buf.memory = V4L2_MEMORY_MMAP;
+
+        if (ioctl(dec_fd, VIDIOC_DQBUF, &buf))
+            break;
+
+        out_free[num_out_free++] = buf.index;
+    }
+}
+
+/* Process whatever the decoder has ready, optionally waiting for
+   something to happen first. */
+static int service(int block)
+{
+    struct pollfd pfd = { dec_fd, POLLIN | POLLOUT | POLLPRI };
+
+    if (block && poll(&pfd, 1, -1) < 0 && errno != EINTR)
+        return -1;
+
+    if (pfd.revents & POLLERR && !cap_streaming && !out_streaming)
+        return -1;
+
+    if (have_events && handle_event())
+        return -1;
+
+    dequeue_output();
+    dequeue_capture();
+    fill_capture();
+
+    return 0;
+}
+
+/* Ask the decoder to flush its remaining frames and wait for the
+   buffer flagged as last. */
+static int drain(void)
+{
+    struct v4l2_decoder_cmd cmd = { 0 };
+
+    if (!out_streaming || !cap_streaming)
+        return 0;
+
+    cmd.cmd = V4L2_DEC_CMD_STOP;
+    if (ioctl(dec_fd, VIDIOC_DECODER_CMD, &cmd))
+        return 0;
+
+    draining = 1;
+
+    while (draining)
+        if (service(1))
+            return -1;
+
+    return 0;
+}
+
+static int dec_decode(AVPacket *p)
+{
+    struct v4l2_buffer buf = { 0 };
+    int i;
+
+    if (!p)
+        return drain();
+
+    if (service(0))
+        return -1;
+
+    while (!num_out_free)
+        if (service(1))
+            return -1;
+
+    i = out_free[--num_out_free];
+
+    if (p->size > out_bufs[i].size) {
+        fprintf(stderr, "V4L2 dec: packet too large (%d > %zu)\n",
+                p->size, out_bufs[i].size);
+        out_free[num_out_free++] = i;
+        return 0;
+    }
+
+    memcpy(out_bufs[i].data, p->data, p->size);
+
+    buf.index     = i;
+    buf.type      = V4L2_BUF_TYPE_VIDEO_OUTPUT;
+    buf.memory    = V4L2_MEMORY_MMAP;
+    buf.bytesused = p->size;
+
+    if (p->pts >= 0) {
+        buf.timestamp.tv_sec  = p->pts / 1000000;
+        buf.timestamp.tv_usec = p->pts % 1000000;
+    }
+
+    xioctl(dec_fd, VIDIOC_QBUF, &buf);
+
+    if (!out_streaming) {
+        i = V4L2_BUF_TYPE_VIDEO_OUTPUT;
+        xioctl(dec_fd, VIDIOC_STREAMON, &i);
+        out_streaming = 1;
+        if (!have_events && start_capture())
+            return -1;
+    }
+
+    return service(0);
+err:
+    return -1;
+}
+
+/* Drop all queued packets and pictures.  Decoding restarts at the
+   next packet, which should be a keyframe. */
+static void dec_flush(void)
+{
+    int type = V4L2_BUF_TYPE_VIDEO_OUTPUT;
+    int i;
+
+    if (out_streaming) {
+        ioctl(dec_fd, VIDIOC_STREAMOFF, &type);
+        out_streaming = 0;
+    }
+
+    for (i = 0; i < num_out_bufs; i++)
+        out_free[i] = i;
+    num_out_free = num_out_bufs;
+    draining = 0;
+
+    if (cap_streaming)
+        start_capture();
+}
+
+static int dec_alloc(struct frame_format *ff, unsigned max_mem,
+                     struct frame **fr, unsigned *nf)
+{
+    struct v4l2_requestbuffers req = { 0 };
+    struct v4l2_control ctrl = { 0 };
+    struct v4l2_pix_format *pix = &cap_fmt.fmt.pix;
+    unsigned min_bufs = 4;
+    unsigned uv_offs[2];
+    int i;
+
+    ctrl.id = V4L2_CID_MIN_BUFFERS_FOR_CAPTURE;
+    if (!ioctl(dec_fd, VIDIOC_G_CTRL, &ctrl))
+        min_bufs = ctrl.value;
+
+    req.count  = MAX(max_mem / pix->sizeimage, min_bufs + MIN_FRAMES + 1);
+    req.type   = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    req.memory = V4L2_MEMORY_MMAP;
+    xioctl(dec_fd, VIDIOC_REQBUFS, &req);
+
+    num_cap_bufs = req.count;
+    fprintf(stderr, "V4L2 dec: %d capture buffers, decoder needs %d\n",
+            num_cap_bufs, min_bufs);
+
+    cap_bufs   = calloc(num_cap_bufs, sizeof(*cap_bufs));
+    cap_frames = calloc(num_cap_bufs, sizeof(*cap_frames));
+    cap_queued = calloc(num_cap_bufs, sizeof(*cap_queued));
+    if (!cap_bufs || !cap_frames || !cap_queued)
+        goto err;
+
+    if (map_buffers(V4L2_BUF_TYPE_VIDEO_CAPTURE, cap_bufs, num_cap_bufs))
+        goto err;
+
+    uv_offs[0] = pix->bytesperline * pix->height;
+    uv_offs[1] = uv_offs[0] + uv_offs[0] / 4;
+
+    for (i = 0; i < num_cap_bufs; i++) {
+        struct frame *f = &cap_frames[i];
+
+        f->virt[0]     = cap_bufs[i].data;
+        f->virt[1]     = cap_bufs[i].data + uv_offs[0];
+        f->linesize[0] = ff->y_stride;
+        f->linesize[1] = ff->uv_stride;
+
+        if (ff->pixfmt == AV_PIX_FMT_YUV420P) {
+            f->virt[2]     = cap_bufs[i].data + uv_offs[1];
+            f->linesize[2] = ff->uv_stride;
+        }
+    }
+
+    *fr = cap_frames;
+    *nf = num_cap_bufs;
+
+    return 0;
+err:
+    free(cap_bufs);
+    free(cap_frames);
+    free(cap_queued);
+    cap_bufs   = NULL;
+    cap_frames = NULL;
+    cap_queued = NULL;
+    return -1;
+}
+
+static void dec_free(struct frame *frames, unsigned nf)
+{
+    struct v4l2_requestbuffers req = { 0 };
+    int type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+
+    ioctl(dec_fd, VIDIOC_STREAMOFF, &type);
+    cap_streaming = 0;
+
+    free_buffers(cap_bufs, num_cap_bufs);
+
+    req.type   = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    req.memory = V4L2_MEMORY_MMAP;
+    ioctl(dec_fd, VIDIOC_REQBUFS, &req);
+
+    free(cap_bufs);
+    free(cap_frames);
+    free(cap_queued);
+    cap_bufs   = NULL;
+    cap_frames = NULL;
+    cap_queued = NULL;
+    num_cap_bufs = 0;
+    num_cap_queued = 0;
+}
+
+static const struct memman dec_memman = {
+    .name         = "v4l2dec",
+    .alloc_frames = dec_alloc,
+    .free_frames  = dec_free,
+};
+
+CODEC(v4l2) = {
+    .name   = "v4l2",
+    .open   = dec_open,
+    .decode = dec_decode,
+    .close  = dec_close,
+    .flush  = dec_flush,
+    .memman = &dec_memman,
+};
@@ -0,0 +1,888 @@
+/*
+    Copyright (C) 2026 Mans Rullgard
+
+    Permission is hereby granted, free of charge, to any person
+    obtaining a copy of this software and associated documentation
+    files (the "Software"), to deal in the Software without
+    restriction, including without limitation the rights to use, copy,
+    modify, merge, publish, distribute, sublicense, and/or sell copies
+    of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be
+    included in all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+    EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+    MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+    NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+    HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+    WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+    DEALINGS IN THE SOFTWARE.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <poll.h>
+#include <signal.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include <wayland-client.h>
+#include "xdg-shell-client-protocol.h"
+#include "viewporter-client-protocol.h"
+#include "presentation-time-client-protocol.h"
+#include "linux-dmabuf-unstable-v1-client-protocol.h"
+
+#include "display.h"
+#include "dmabuf.h"
+#include "memman.h"
+#include "pixfmt.h"
+#include "util.h"
+
+#define NUM_IMAGES 3
+
+static struct wl_display    *dpy;
+static struct wl_registry   *registry;
+static struct wl_compositor *compositor;
+static struct wl_shm        *shm;
+static struct xdg_wm_base   *wm_base;
+static struct wp_viewporter *viewporter;
+static struct wp_presentation *presentation;
+static struct zwp_linux_dmabuf_v1 *dmabuf;
+
+static struct wl_surface    *surface;
+static struct xdg_surface   *xdg_surface;
+static struct xdg_toplevel  *toplevel;
+static struct wp_viewport   *viewport;
+
+static uint32_t shm_formats;
+static uint32_t dmabuf_formats;
+static clockid_t pres_clock = CLOCK_MONOTONIC;
+
+static uint32_t buf_format;
+static int use_dmabuf;
+static int configured;
+static int win_w, win_h;
+
+static struct frame_format ffmt;
+static struct frame_format dfmt;
+static const struct pixconv *pixconv;
+
+static int pool_fd = -1;
+static uint8_t *pool_mem;
+static size_t pool_size;
+
+struct wayland_buf {
+    struct wl_buffer *buf;
+    struct frame *frame;
+    int dmabuf_fd;
+    int busy;
+};
+
+static struct wayland_buf *bufs;
+static unsigned num_frames;
+static struct frame *frames;
+
+/* wl_buffers wrapping frames from a dmabuf memman, made on first use. */
+static struct wayland_buf **imports;
+static unsigned num_imports;
+static int importing;
+
+static struct wayland_buf images[NUM_IMAGES];
+static int img_fd = -1;
+static uint8_t *img_mem;
+static size_t img_size;
+static int cur_image;
+
+static struct wp_presentation_feedback *feedback;
+static struct timespec commit_time;
+static struct timespec last_present;
+static uint32_t refresh_ns;
+static unsigned num_presented;
+static unsigned num_discarded;
+static uint64_t total_latency;
+
+static const struct {
+    enum AVPixelFormat pixfmt;
+    uint32_t buf_format;
+    unsigned bit;
+} format_map[] = {
+    { AV_PIX_FMT_YUV420P, WL_SHM_FORMAT_YUV420, 1 },
+    { AV_PIX_FMT_NV12,    WL_SHM_FORMAT_NV12,   2 },
+};
+
+static unsigned format_bit(uint32_t fmt)
+{
+    int i;
+
+    for (i = 0; i < ARRAY_SIZE(format_map); i++)
+        if (format_map[i].buf_format == fmt)
+            return format_map[i].bit;
+
+    return 0;
+}
+
+static void shm_format(void *data, struct wl_shm *wl_shm, uint32_t format)
+{
+    shm_formats |= format_bit(format);
+}
+
+static const struct wl_shm_listener shm_listener = {
+    .format = shm_format,
+};
+
+static void dmabuf_format(void *data, struct zwp_linux_dmabuf_v1 *d,
+                          uint32_t format)
+{
+    dmabuf_formats |= format_bit(format);
+}
+
+static void dmabuf_modifier(void *data, struct zwp_linux_dmabuf_v1 *d,
+                            uint32_t format, uint32_t mod_hi, uint32_t mod_lo)
+{
+    if (!mod_hi && !mod_lo)
+        dmabuf_formats |= format_bit(format);
+}
+
+static const struct zwp_linux_dmabuf_v1_listener dmabuf_listener = {
+    .format   = dmabuf_format,
+    .modifier = dmabuf_modifier,
+};
+
+static void pres_clock_id(void *data, struct wp_presentation *p,
+                          uint32_t clk_id)
+{
+    pres_clock = clk_id;
+}
+
+static const struct wp_presentation_listener pres_listener = {
+    .clock_id = pres_clock_id,
+};
+
+static void wm_ping(void *data, struct xdg_wm_base *wm, uint32_t serial)
+{
+    xdg_wm_base_pong(wm, serial);
+}
+
+static const struct xdg_wm_base_listener wm_listener = {
+    .ping = wm_ping,
+};
+
+static void registry_global(void *data, struct wl_registry *reg,
+                            uint32_t name, const char *iface,
+                            uint32_t version)
+{
+    if (!strcmp(iface, wl_compositor_interface.name)) {
+        compositor = wl_registry_bind(reg, name, &wl_compositor_interface, 1);
+    } else if (!strcmp(iface, wl_shm_interface.name)) {
+        shm = wl_registry_bind(reg, name, &wl_shm_interface, 1);
+        wl_shm_add_listener(shm, &shm_listener, NULL);
+    } else if (!strcmp(iface, xdg_wm_base_interface.name)) {
+        wm_base = wl_registry_bind(reg, name, &xdg_wm_base_interface, 1);
+        xdg_wm_base_add_listener(wm_base, &wm_listener, NULL);
+    } else if (!strcmp(iface, wp_viewporter_interface.name)) {
+        viewporter = wl_registry_bind(reg, name, &wp_viewporter_interface, 1);
+    } else if (!strcmp(iface, wp_presentation_interface.name)) {
+        presentation =
+            wl_registry_bind(reg, name, &wp_presentation_interface, 1);
+        wp_presentation_add_listener(presentation, &pres_listener, NULL);
+    } else if (!strcmp(iface, zwp_linux_dmabuf_v1_interface.name) &&
+               version >= 2) {
+        dmabuf = wl_registry_bind(reg, name, &zwp_linux_dmabuf_v1_interface,
+                                  MIN(version, 3));
+        zwp_linux_dmabuf_v1_add_listener(dmabuf, &dmabuf_listener, NULL);
+    }
+}
+
+static void registry_global_remove(void *data, struct wl_registry *reg,
+                                   uint32_t name)
+{
+}
+
+static const struct wl_registry_listener registry_listener = {
+    .global        = registry_global,
+    .global_remove = registry_global_remove,
+};
+
+static void xdg_surface_configure(void *data, struct xdg_surface *s,
+                                  uint32_t serial)
+{
+    xdg_surface_ack_configure(s, serial);
+    configured = 1;
+}
+
+static const struct xdg_surface_listener xdg_surface_listener = {
+    .configure = xdg_surface_configure,
+};
+
+static void toplevel_configure(void *data, struct xdg_toplevel *t,
+                               int32_t w, int32_t h, struct wl_array *states)
+{
+    if (w > 0 && h > 0 && (w != win_w || h != win_h)) {
+        win_w = w;
+        win_h = h;
+        if (viewport)
+            wp_viewport_set_destination(viewport, w, h);
+    }
+}
+
+static void toplevel_close(void *data, struct xdg_toplevel *t)
+{
+    raise(SIGINT);
+}
+
+static const struct xdg_toplevel_listener toplevel_listener = {
+    .configure = toplevel_configure,
+    .close     = toplevel_close,
+};
+
+static void buffer_release(void *data, struct wl_buffer *buf)
+{
+    struct wayland_buf *wf = data;
+
+    wf->busy = 0;
+
+    if (wf->frame)
+        ofbp_put_frame(wf->frame);
+}
+
+static const struct wl_buffer_listener buffer_listener = {
+    .release = buffer_release,
+};
+
+static void feedback_sync_output(void *data,
+                                 struct wp_presentation_feedback *fb,
+                                 struct wl_output *output)
+{
+}
+
+static void feedback_presented(void *data,
+                               struct wp_presentation_feedback *fb,
+                               uint32_t tv_sec_hi, uint32_t tv_sec_lo,
+                               uint32_t tv_nsec, uint32_t refresh,
+                               uint32_t seq_hi, uint32_t seq_lo,
+                               uint32_t flags)
+{
+    uint64_t sec = (uint64_t)tv_sec_hi << 32 | tv_sec_lo;
+
+    total_latency += (sec - commit_time.tv_sec) * 1000000000ULL +
+        tv_nsec - commit_time.tv_nsec;
+    num_presented++;
+
+    last_present.tv_sec  = sec;
+    last_present.tv_nsec = tv_nsec;
+    refresh_ns = refresh;
+
+    wp_presentation_feedback_destroy(fb);
+    feedback = NULL;
+}
+
+static void feedback_discarded(void *data,
+                               struct wp_presentation_feedback *fb)
+{
+    num_discarded++;
+
+    wp_presentation_feedback_destroy(fb);
+    feedback = NULL;
+}
+
+static const struct wp_presentation_feedback_listener feedback_listener = {
+    .sync_output = feedback_sync_output,
+    .presented   = feedback_presented,
+    .discarded   = feedback_discarded,
+};
+
+/* Dispatch incoming events, waiting for some to arrive if block is set. */
+static int wayland_events(int block)
+{
+    struct pollfd pfd = { wl_display_get_fd(dpy), POLLIN };
+
+    while (wl_display_prepare_read(dpy))
+        wl_display_dispatch_pending(dpy);
+
+    wl_display_flush(dpy);
+
+    if (poll(&pfd, 1, block ? -1 : 0) > 0) {
+        if (wl_display_read_events(dpy))
+            return -1;
+    } else {
+        wl_display_cancel_read(dpy);
+    }
+
+    return wl_display_dispatch_pending(dpy) < 0;
+}
+
+static void params_created(void *data,
+                           struct zwp_linux_buffer_params_v1 *params,
+                           struct wl_buffer *buf)
+{
+    struct wayland_buf *wf = data;
+    wf->buf = buf;
+}
+
+static void params_failed(void *data,
+                          struct zwp_linux_buffer_params_v1 *params)
+{
+}
+
+static const struct zwp_linux_buffer_params_v1_listener params_listener = {
+    .created = params_created,
+    .failed  = params_failed,
+};
+
+/* Wrap the dmabuf fd, whose contents start at base, holding frame f. */
+static struct wl_buffer *
+create_dmabuf_buffer(struct wayland_buf *wf, int fd, const uint8_t *base,
+                     const struct frame *f)
+{
+    struct zwp_linux_buffer_params_v1 *params;
+    int nplanes = buf_format == WL_SHM_FORMAT_NV12 ? 2 : 3;
+    int i;
+
+    params = zwp_linux_dmabuf_v1_create_params(dmabuf);
+    zwp_linux_buffer_params_v1_add_listener(params, &params_listener, wf);
+
+    for (i = 0; i < nplanes; i++)
+        zwp_linux_buffer_params_v1_add(params, fd, i, f->virt[i] - base,
+                                       f->linesize[i], 0, 0);
+
+    zwp_linux_buffer_params_v1_create(params, ffmt.width, ffmt.height,
+                                      buf_format, 0);
+    wl_display_roundtrip(dpy);
+    zwp_linux_buffer_params_v1_destroy(params);
+
+    return wf->buf;
+}
+
+static int
+wayland_alloc_frames(struct frame_format *ff, unsigned bufsize,
+                struct frame **fr, unsigned *nf)
+{
+    struct wl_shm_pool *pool = NULL;
+    unsigned buf_w = ff->width, buf_h = ff->height;
+    unsigned frame_size;
+    int i;
+
+    frame_size = ALIGN(buf_w * buf_h * 3 / 2, 4096);
+    num_frames = MAX(bufsize / frame_size, MIN_FRAMES);
+    pool_size  = (size_t)num_frames * frame_size;
+
+    ffmt = *ff;
+
+    pool_fd = memfd_create("omapfbplay", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+    if (pool_fd == -1) {
+        perror("memfd_create");
+        return -1;
+    }
+
+    if (ftruncate(pool_fd, pool_size)) {
+        perror("ftruncate");
+        goto err;
+    }
+
+    fcntl(pool_fd, F_ADD_SEALS, F_SEAL_SHRINK);
+
+    pool_mem = mmap(NULL, pool_size, PROT_READ | PROT_WRITE, MAP_SHARED,
+                    pool_fd, 0);
+    if (pool_mem == MAP_FAILED) {
+        perror("mmap");
+        pool_mem = NULL;
+        goto err;
+    }
+
+    frames    = calloc(num_frames, sizeof(*frames));
+    bufs = calloc(num_frames, sizeof(*bufs));
+    if (!frames || !bufs)
+        goto err;
+
+    if (!dmabuf || !(dmabuf_formats & format_bit(buf_format)))
+        pool = wl_shm_create_pool(shm, pool_fd, pool_size);
+
+    for (i = 0; i < num_frames; i++) {
+        struct frame *f = frames + i;
+        struct wayland_buf *wf = bufs + i;
+        size_t offset = (size_t)i * frame_size;
+        uint8_t *p = pool_mem + offset;
+
+        f->virt[0]     = p;
+        f->virt[1]     = p + buf_w * buf_h;
+        f->linesize[0] = buf_w;
+
+        if (buf_format == WL_SHM_FORMAT_NV12) {
+            f->linesize[1] = buf_w;
+        } else {
+            f->virt[2]     = f->virt[1] + buf_w * buf_h / 4;
+            f->linesize[1] = buf_w / 2;
+            f->linesize[2] = buf_w / 2;
+        }
+
+        wf->frame     = f;
+        wf->dmabuf_fd = -1;
+
+        if (!pool) {
+            wf->dmabuf_fd = ofbp_udmabuf(pool_fd, offset, frame_size);
+            if (wf->dmabuf_fd == -1 ||
+                !create_dmabuf_buffer(wf, wf->dmabuf_fd, p, f)) {
+                fprintf(stderr, "Wayland: dmabuf import failed, "
+                        "using wl_shm\n");
+                if (wf->dmabuf_fd != -1)
+                    close(wf->dmabuf_fd);
+                wf->dmabuf_fd = -1;
+                pool = wl_shm_create_pool(shm, pool_fd, pool_size);
+            }
+        }
+
+        if (!wf->buf)
+            wf->buf = wl_shm_pool_create_buffer(pool, offset, buf_w, buf_h,
+                                                buf_w, buf_format);
+
+        wl_buffer_add_listener(wf->buf, &buffer_listener, wf);
+    }
+
+    if (pool)
+        wl_shm_pool_destroy(pool);
+
+    use_dmabuf = bufs[0].dmabuf_fd != -1;
+
+    fprintf(stderr, "Wayland: %d %s frame buffers\n", num_frames,
+            use_dmabuf ? "dmabuf" : "shm");
+
+    ff->y_stride  = buf_w;
+    ff->uv_stride = frames[0].linesize[1];
+
+    *fr = frames;
+    *nf = num_frames;
+
+    return 0;
+
+err:
+    if (pool_mem)
+        munmap(pool_mem, pool_size);
+    pool_mem = NULL;
+    close(pool_fd);
+    pool_fd = -1;
+    free(frames);
+    free(bufs);
+    return -1;
+}
+
+static void wayland_free_frames(struct frame *fr, unsigned nf)
+{
+    int i;
+
+    for (i = 0; i < num_frames; i++) {
+        wl_buffer_destroy(bufs[i].buf);
+        if (bufs[i].dmabuf_fd != -1)
+            close(bufs[i].dmabuf_fd);
+    }
+
+    munmap(pool_mem, pool_size);
+    close(pool_fd);
+    pool_fd = -1;
+
+    free(bufs);
+    free(frames);
+    bufs = NULL;
+    frames = NULL;
+}
+
+static int alloc_images(void)
+{
+    struct wl_shm_pool *pool;
+    unsigned stride = dfmt.disp_w * 4;
+    unsigned size = ALIGN(stride * dfmt.disp_h, 4096);
+    int i;
+
+    img_size = NUM_IMAGES * size;
+
+    img_fd = memfd_create("omapfbplay-rgb", MFD_CLOEXEC);
+    if (img_fd == -1 || ftruncate(img_fd, img_size))
+        return -1;
+
+    img_mem = mmap(NULL, img_size, PROT_READ | PROT_WRITE, MAP_SHARED,
+                   img_fd, 0);
+    if (img_mem == MAP_FAILED) {
+        img_mem = NULL;
+        return -1;
+    }
+
+    pool = wl_shm_create_pool(shm, img_fd, img_size);
+
+    for (i = 0; i < NUM_IMAGES; i++) {
+        images[i].buf = wl_shm_pool_create_buffer(pool, i * size,
+                                                  dfmt.disp_w, dfmt.disp_h,
+                                                  stride,
+                                                  WL_SHM_FORMAT_XRGB8888);
+        images[i].dmabuf_fd = -1;
+        wl_buffer_add_listener(images[i].buf, &buffer_listener, &images[i]);
+    }
+
+    wl_shm_pool_destroy(pool);
+
+    dfmt.disp_x   = 0;
+    dfmt.disp_y   = 0;
+    dfmt.width    = dfmt.disp_w;
+    dfmt.height   = dfmt.disp_h;
+    dfmt.y_stride = stride;
+
+    pixconv->close();
+
+    return pixconv->open(&ffmt, &dfmt);
+}
+
+/* The wl_buffer for a frame of a dmabuf memman.  As the dmaheap
+   memman documents, frame n starts ofbp_frame_colour(n) bytes into
+   its buffer. */
+static struct wayland_buf *import_frame(struct frame *f)
+{
+    struct wayland_buf *wf;
+
+    if (f->frame_num >= num_imports) {
+        unsigned n = f->frame_num + 1;
+        struct wayland_buf **p = realloc(imports, n * sizeof(*p));
+        if (!p)
+            return NULL;
+        memset(p + num_imports, 0, (n - num_imports) * sizeof(*p));
+        imports = p;
+        num_imports = n;
+    }
+
+    wf = imports[f->frame_num];
+    if (wf)
+        return wf;
+
+    wf = calloc(1, sizeof(*wf));
+    if (!wf)
+        return NULL;
+
+    wf->frame = f;
+    wf->dmabuf_fd = -1;
+
+    if (!create_dmabuf_buffer(wf, f->dmabuf_fd,
+                              f->virt[0] - ofbp_frame_colour(f->frame_num),
+                              f)) {
+        fprintf(stderr, "Wayland: dmabuf import of frame %d failed\n",
+                f->frame_num);
+        free(wf);
+        return NULL;
+    }
+
+    wl_buffer_add_listener(wf->buf, &buffer_listener, wf);
+
+    return imports[f->frame_num] = wf;
+}
+
+static void free_imports(void)
+{
+    unsigned i;
+
+    for (i = 0; i < num_imports; i++) {
+        if (imports[i]) {
+            wl_buffer_destroy(imports[i]->buf);
+            free(imports[i]);
+        }
+    }
+
+    free(imports);
+    imports = NULL;
+    num_imports = 0;
+}
+
+static void free_images(void)
+{
+    int i;
+
+    for (i = 0; i < NUM_IMAGES; i++)
+        if (images[i].buf)
+            wl_buffer_destroy(images[i].buf);
+
+    if (img_mem)
+        munmap(img_mem, img_size);
+    if (img_fd != -1)
+        close(img_fd);
+}
+
+static void cleanup(void)
+{
+    if (feedback)     wp_presentation_feedback_destroy(feedback);
+    if (viewport)     wp_viewport_destroy(viewport);
+    if (toplevel)     xdg_toplevel_destroy(toplevel);
+    if (xdg_surface)  xdg_surface_destroy(xdg_surface);
+    if (surface)      wl_surface_destroy(surface);
+    if (dmabuf)       zwp_linux_dmabuf_v1_destroy(dmabuf);
+    if (presentation) wp_presentation_destroy(presentation);
+    if (viewporter)   wp_viewporter_destroy(viewporter);
+    if (wm_base)      xdg_wm_base_destroy(wm_base);
+    if (shm)          wl_shm_destroy(shm);
+    if (compositor)   wl_compositor_destroy(compositor);
+    if (registry)     wl_registry_destroy(registry);
+    if (dpy)          wl_display_disconnect(dpy);
+
+    feedback     = NULL;
+    refresh_ns   = 0;
+    viewport     = NULL;
+    toplevel     = NULL;
+    xdg_surface  = NULL;
+    surface      = NULL;
+    dmabuf       = NULL;
+    presentation = NULL;
+    viewporter   = NULL;
+    wm_base      = NULL;
+    shm          = NULL;
+    compositor   = NULL;
+    registry     = NULL;
+    dpy          = NULL;
+}
+
+static int wayland_open(const char *name, struct frame_format *dp,
+                   struct frame_format *ff)
+{
+    int i;
+
+    dpy = wl_display_connect(name);
+    if (!dpy) {
+        fprintf(stderr, "Wayland: error connecting to display\n");
+        return -1;
+    }
+
+    registry = wl_display_get_registry(dpy);
+    wl_registry_add_listener(registry, &registry_listener, NULL);
+    wl_display_roundtrip(dpy);
+    wl_display_roundtrip(dpy);
+
+    if (!compositor || !shm || !wm_base) {
+        fprintf(stderr, "Wayland: required globals missing\n");
+        goto err;
+    }
+
+    fprintf(stderr, "Wayland: viewporter %s, presentation %s, dmabuf %s\n",
+            viewporter ? "yes" : "no", presentation ? "yes" : "no",
+            dmabuf ? "yes" : "no");
+
+    dp->width  = ff->disp_w;
+    dp->height = ff->disp_h;
+    dp->pixfmt = AV_PIX_FMT_RGB32;
+    dp->y_stride = ff->disp_w * 4;
+
+    buf_format = WL_SHM_FORMAT_XRGB8888;
+
+    for (i = 0; i < ARRAY_SIZE(format_map); i++) {
+        if (format_map[i].pixfmt == ff->pixfmt &&
+            (shm_formats | dmabuf_formats) & format_map[i].bit) {
+            dp->pixfmt = ff->pixfmt;
+            buf_format = format_map[i].buf_format;
+        }
+    }
+
+    return 0;
+
+err:
+    cleanup();
+    return -1;
+}
+
+static int wayland_enable(struct frame_format *ff, unsigned flags,
+                     const struct pixconv *pc, struct frame_format *df)
+{
+    ffmt = *ff;
+    dfmt = *df;
+    pixconv = pc;
+    importing = !pc && !frames;
+
+    win_w = df->disp_w;
+    win_h = df->disp_h;
+
+    surface = wl_compositor_create_surface(compositor);
+    xdg_surface = xdg_wm_base_get_xdg_surface(wm_base, surface);
+    xdg_surface_add_listener(xdg_surface, &xdg_surface_listener, NULL);
+    toplevel = xdg_surface_get_toplevel(xdg_surface);
+    xdg_toplevel_add_listener(toplevel, &toplevel_listener, NULL);
+    xdg_toplevel_set_title(toplevel, "omapfbplay");
+
+    if (flags & OFBP_FULLSCREEN)
+        xdg_toplevel_set_fullscreen(toplevel, NULL);
+
+    if (viewporter) {
+        viewport = wp_viewporter_get_viewport(viewporter, surface);
+        if (!pixconv)
+            wp_viewport_set_source(viewport,
+                                   wl_fixed_from_int(ff->disp_x),
+                                   wl_fixed_from_int(ff->disp_y),
+                                   wl_fixed_from_int(ff->disp_w),
+                                   wl_fixed_from_int(ff->disp_h));
+        wp_viewport_set_destination(viewport, win_w, win_h);
+    }
+
+    wl_surface_commit(surface);
+
+    while (!configured)
+        if (wl_display_dispatch(dpy) < 0)
+            return -1;
+
+    if (pixconv && alloc_images()) {
+        fprintf(stderr, "Wayland: error setting up RGB buffers\n");
+        return -1;
+    }
+
+    return 0;
+}
+
+static void wayland_prepare(struct frame *f)
+{
+    uint8_t *dst[3] = { NULL };
+    int i;
+
+    wayland_events(0);
+
+    if (!pixconv)
+        return;
+
+    cur_image = -1;
+
+    for (;;) {
+        for (i = 0; i < NUM_IMAGES; i++)
+            if (!images[i].busy)
+                break;
+        if (i < NUM_IMAGES)
+            break;
+        if (wayland_events(1))
+            return;
+    }
+
+    cur_image = i;
+    dst[0] = img_mem + img_size / NUM_IMAGES * i;
+
+    pixconv->convert(dst, f->vdata, NULL, NULL);
+}
+
+/*
+ * With presentation feedback, pace on the compositor's clock rather
+ * than the timer: wait for the previous commit to reach the screen,
+ * pick the vblank nearest to the frame's due time, and return one
+ * refresh period before it so the commit is latched for that vblank.
+ * Until the first feedback arrives the timer paces instead.
+ */
+static int wayland_wait(int64_t delay)
+{
+    struct timespec now, next;
+    int64_t due, vbl;
+
+    if (!presentation)
+        return -1;
+
+    clock_gettime(pres_clock, &now);
+    due = now.tv_sec * 1000000000LL + now.tv_nsec + MAX(delay, 0);
+
+    while (feedback)
+        if (wayland_events(1))
+            return -1;
+
+    if (!refresh_ns)
+        return -1;
+
+    vbl = last_present.tv_sec * 1000000000LL + last_present.tv_nsec +
+        refresh_ns;
+    while (vbl + refresh_ns / 2 < due)
+        vbl += refresh_ns;
+
+    vbl -= refresh_ns;
+    next.tv_sec  = vbl / 1000000000;
+    next.tv_nsec = vbl % 1000000000;
+    clock_nanosleep(pres_clock, TIMER_ABSTIME, &next, NULL);
+
+    return 0;
+}
+
+static void wayland_show(struct frame *f)
+{
+    struct wayland_buf *wf;
+
+    if (pixconv) {
+        if (cur_image >= 0)
+            pixconv->finish();
+        ofbp_put_frame(f);
+        if (cur_image < 0)
+            return;
+        wf = &images[cur_image];
+    } else if (importing) {
+        wf = import_frame(f);
+        if (!wf) {
+            ofbp_put_frame(f);
+            return;
+        }
+    } else {
+        wf = &bufs[f->frame_num];
+    }
+
+    wf->busy = 1;
+
+    wl_surface_attach(surface, wf->buf, 0, 0);
+    wl_surface_damage(surface, 0, 0, INT32_MAX, INT32_MAX);
+
+    if (presentation) {
+        feedback = wp_presentation_feedback(presentation, surface);
+        wp_presentation_feedback_add_listener(feedback, &feedback_listener,
+                                              NULL);
+        clock_gettime(pres_clock, &commit_time);
+    }
+
+    wl_surface_commit(surface);
+    wl_display_flush(dpy);
+}
+
+static void wayland_close(void)
+{
+    if (num_presented)
+        fprintf(stderr, "Wayland: %u presented, %u discarded, "
+                "latency %u us\n", num_presented, num_discarded,
+                (unsigned)(total_latency / num_presented / 1000));
+
+    if (pixconv)
+        free_images();
+    free_imports();
+
+    cleanup();
+}
+
+/* Frames from a dmabuf memman can be shown directly if the compositor
+   takes dmabufs of their format. */
+static int wayland_import(const struct frame_format *ff)
+{
+    int i;
+
+    if (!dmabuf)
+        return -1;
+
+    for (i = 0; i < ARRAY_SIZE(format_map); i++)
+        if (format_map[i].pixfmt == ff->pixfmt &&
+            dmabuf_formats & format_map[i].bit)
+            return 0;
+
+    return -1;
+}
+
+static const struct memman wayland_mem = {
+    .name         = "wayland",
+    .alloc_frames = wayland_alloc_frames,
+    .free_frames  = wayland_free_frames,
+};
+
+DISPLAY(wayland) = {
+    .name    = "wayland",
+    .flags   = OFBP_FULLSCREEN,
+    .open    = wayland_open,
+    .enable  = wayland_enable,
+    .prepare = wayland_prepare,
+    .wait    = wayland_wait,
+    .show    = wayland_show,
+    .close   = wayland_close,
+    .import  = wayland_import,
+    .memman  = &wayland_mem,
+};
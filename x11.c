@@ -0,0 +1,340 @@
+/*
+    Copyright (C) 2026 Mans Rullgard
+
+    Permission is hereby granted, free of charge, to any person
+    obtaining a copy of this software and associated documentation
+    files (the "Software"), to deal in the Software without
+    restriction, including without limitation the rights to use, copy,
+    modify, merge, publish, distribute, sublicense, and/or sell copies
+    of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be
+    included in all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+    EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+    MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+    NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+    HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+    WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+    DEALINGS IN THE SOFTWARE.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <sys/shm.h>
+#include <sys/ipc.h>
+#include <X11/Xlib.h>
+#include <X11/Xutil.h>
+#include <X11/extensions/XShm.h>
+
+#include "display.h"
+#include "pixconv.h"
+#include "util.h"
+#include "xutil.h"
+
+#define NUM_IMAGES 3
+
+static Display *dpy;
+static Window win;
+static GC gc;
+static Visual *visual;
+static int depth;
+static int bypp;
+static int shm_completion;
+static const struct pixconv *pixconv;
+static struct frame_format ffmt;
+static struct frame_format dfmt;
+static unsigned win_w, win_h;
+static unsigned new_w, new_h;
+
+static struct {
+    XImage *xim;
+    XShmSegmentInfo xshm;
+    int busy;
+} images[NUM_IMAGES];
+static unsigned num_busy;
+static int cur_image;
+
+static void x11_events(unsigned max)
+{
+    XEvent xe;
+    int i;
+
+    while (num_busy > max || XPending(dpy)) {
+        XNextEvent(dpy, &xe);
+
+        if (xe.type == shm_completion) {
+            XShmCompletionEvent *ce = (XShmCompletionEvent *)&xe;
+            for (i = 0; i < NUM_IMAGES; i++) {
+                if (images[i].busy && images[i].xshm.shmseg == ce->shmseg) {
+                    images[i].busy = 0;
+                    num_busy--;
+                    break;
+                }
+            }
+        } else if (xe.type == ConfigureNotify) {
+            new_w = xe.xconfigure.width;
+            new_h = xe.xconfigure.height;
+        }
+    }
+}
+
+static void free_images(void)
+{
+    int i;
+
+    x11_events(0);
+
+    for (i = 0; i < NUM_IMAGES; i++) {
+        if (!images[i].xim)
+            continue;
+        XShmDetach(dpy, &images[i].xshm);
+        XDestroyImage(images[i].xim);
+        shmdt(images[i].xshm.shmaddr);
+        images[i].xim = NULL;
+    }
+}
+
+static int alloc_images(unsigned w, unsigned h)
+{
+    int i;
+
+    for (i = 0; i < NUM_IMAGES; i++) {
+        XShmSegmentInfo *xshm = &images[i].xshm;
+        XImage *xim = XShmCreateImage(dpy, visual, depth, ZPixmap, NULL,
+                                      xshm, w, h);
+        unsigned size;
+
+        if (!xim)
+            return -1;
+
+        size = xim->bytes_per_line * xim->height;
+
+        xshm->shmid = shmget(IPC_PRIVATE, size, IPC_CREAT | 0600);
+        if (xshm->shmid == -1) {
+            perror("shmget");
+            XDestroyImage(xim);
+            return -1;
+        }
+
+        xshm->shmaddr = shmat(xshm->shmid, 0, 0);
+        xshm->readOnly = False;
+        XShmAttach(dpy, xshm);
+        shmctl(xshm->shmid, IPC_RMID, NULL);
+
+        xim->data = xshm->shmaddr;
+        memset(xim->data, 0, size);
+
+        images[i].xim  = xim;
+        images[i].busy = 0;
+    }
+
+    return 0;
+}
+
+static int setup_output(unsigned w, unsigned h)
+{
+    free_images();
+
+    if (alloc_images(w, h)) {
+        fprintf(stderr, "X11: error allocating %dx%d images\n", w, h);
+        return -1;
+    }
+
+    win_w = new_w = w;
+    win_h = new_h = h;
+
+    dfmt.disp_w = ffmt.disp_w;
+    dfmt.disp_h = ffmt.disp_h;
+    ofbp_scale(&dfmt.disp_x, &dfmt.disp_y, &dfmt.disp_w, &dfmt.disp_h, w, h);
+    dfmt.width    = w;
+    dfmt.height   = h;
+    dfmt.y_stride = images[0].xim->bytes_per_line;
+
+    pixconv->close();
+    if (pixconv->open(&ffmt, &dfmt)) {
+        fprintf(stderr, "X11: pixel converter failed for %dx%d\n",
+                dfmt.disp_w, dfmt.disp_h);
+        return -1;
+    }
+
+    XClearWindow(dpy, win);
+
+    return 0;
+}
+
+static enum AVPixelFormat get_pixfmt(void)
+{
+    static const uint16_t byte_order = 1;
+    XPixmapFormatValues *pf;
+    int bpp = 0;
+    int n, i;
+
+    pf = XListPixmapFormats(dpy, &n);
+    for (i = 0; i < n; i++)
+        if (pf[i].depth == depth)
+            bpp = pf[i].bits_per_pixel;
+    XFree(pf);
+
+    bypp = bpp / 8;
+
+    if (ImageByteOrder(dpy) !=
+        (*(const uint8_t *)&byte_order ? LSBFirst : MSBFirst))
+        return AV_PIX_FMT_NONE;
+
+    if (bpp == 32 && visual->red_mask == 0xff0000 &&
+        visual->green_mask == 0xff00 && visual->blue_mask == 0xff)
+        return AV_PIX_FMT_RGB32;
+
+    if (bpp == 32 && visual->red_mask == 0xff &&
+        visual->green_mask == 0xff00 && visual->blue_mask == 0xff0000)
+        return AV_PIX_FMT_BGR32;
+
+    if (bpp == 16 && visual->red_mask == 0xf800 &&
+        visual->green_mask == 0x7e0 && visual->blue_mask == 0x1f)
+        return AV_PIX_FMT_RGB565;
+
+    return AV_PIX_FMT_NONE;
+}
+
+static int x11_open(const char *name, struct frame_format *dp,
+                    struct frame_format *ff)
+{
+    XWindowAttributes attr;
+    int screen;
+
+    dpy = XOpenDisplay(name);
+    if (!dpy) {
+        fprintf(stderr, "X11: error opening display\n");
+        return -1;
+    }
+
+    if (!XShmQueryExtension(dpy)) {
+        fprintf(stderr, "X11: MIT-SHM extension not present\n");
+        goto err;
+    }
+
+    shm_completion = XShmGetEventBase(dpy) + ShmCompletion;
+
+    screen = DefaultScreen(dpy);
+    visual = DefaultVisual(dpy, screen);
+    depth  = DefaultDepth(dpy, screen);
+
+    dp->pixfmt = get_pixfmt();
+    if (dp->pixfmt == AV_PIX_FMT_NONE) {
+        fprintf(stderr, "X11: unsupported visual, depth %d\n", depth);
+        goto err;
+    }
+
+    fprintf(stderr, "X11: depth %d, %d bytes per pixel\n", depth, bypp);
+
+    XGetWindowAttributes(dpy, RootWindow(dpy, screen), &attr);
+    dp->width    = attr.width;
+    dp->height   = attr.height;
+    dp->y_stride = attr.width * bypp;
+
+    return 0;
+
+err:
+    XCloseDisplay(dpy);
+    dpy = NULL;
+    return -1;
+}
+
+static int x11_enable(struct frame_format *ff, unsigned flags,
+                      const struct pixconv *pc, struct frame_format *df)
+{
+    int screen = DefaultScreen(dpy);
+
+    if (!pc) {
+        fprintf(stderr, "X11: no pixel converter\n");
+        return -1;
+    }
+
+    pixconv = pc;
+    ffmt = *ff;
+    dfmt = *df;
+
+    win = XCreateWindow(dpy, RootWindow(dpy, screen),
+                        0, 0, df->disp_w, df->disp_h, 0, depth,
+                        InputOutput, visual, 0, NULL);
+    XSelectInput(dpy, win, StructureNotifyMask);
+    XSetWindowBackground(dpy, win, BlackPixel(dpy, screen));
+    gc = XCreateGC(dpy, win, 0, NULL);
+
+    XMapWindow(dpy, win);
+
+    if (flags & OFBP_FULLSCREEN)
+        ofbp_x11_fullscreen(dpy, win);
+
+    return setup_output(df->disp_w, df->disp_h);
+}
+
+static void x11_prepare(struct frame *f)
+{
+    XImage *xim;
+    uint8_t *dst[3] = { NULL };
+    int i;
+
+    x11_events(NUM_IMAGES - 1);
+
+    cur_image = -1;
+
+    if (new_w != win_w || new_h != win_h)
+        if (setup_output(new_w, new_h))
+            return;
+
+    for (i = 0; images[i].busy; i++);
+
+    cur_image = i;
+    xim = images[i].xim;
+
+    dst[0] = (uint8_t *)xim->data + dfmt.disp_y * xim->bytes_per_line +
+        dfmt.disp_x * bypp;
+
+    pixconv->convert(dst, f->vdata, NULL, NULL);
+}
+
+static void x11_show(struct frame *f)
+{
+    if (cur_image < 0) {
+        ofbp_put_frame(f);
+        return;
+    }
+
+    pixconv->finish();
+
+    images[cur_image].busy = 1;
+    num_busy++;
+
+    XShmPutImage(dpy, win, gc, images[cur_image].xim,
+                 0, 0, 0, 0, win_w, win_h, True);
+    XFlush(dpy);
+
+    ofbp_put_frame(f);
+}
+
+static void x11_close(void)
+{
+    if (win) {
+        free_images();
+        XFreeGC(dpy, gc);
+        XDestroyWindow(dpy, win);
+    }
+    XCloseDisplay(dpy);
+}
+
+DISPLAY(x11) = {
+    .name    = "x11",
+    .flags   = OFBP_FULLSCREEN,
+    .open    = x11_open,
+    .enable  = x11_enable,
+    .prepare = x11_prepare,
+    .show    = x11_show,
+    .close   = x11_close,
+};
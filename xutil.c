@@ -0,0 +1,82 @@
+/*
+    Copyright (C) 2009, 2026 Mans Rullgard
+
+    Permission is hereby granted, free of charge, to any person
+    obtaining a copy of this software and associated documentation
+    files (the "Software"), to deal in the Software without
+    restriction, including without limitation the rights to use, copy,
+    modify, merge, publish, distribute, sublicense, and/or sell copies
+    of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be
+    included in all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+    EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+    MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+    NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+    HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+    WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+    DEALINGS IN THE SOFTWARE.
+ */
+
+#include <X11/Xlib.h>
+
+#include "xutil.h"
+
+void
+ofbp_x11_fullscreen(Display *dpy, Window win)
+{
+    Atom supporting;
+    int netwm = 0;
+
+    supporting = XInternAtom(dpy, "_NET_SUPPORTING_WM_CHECK", True);
+
+    if (supporting != None) {
+        Atom xa_window = XInternAtom(dpy, "WINDOW", True);
+        unsigned long count, bytes_remain;
+        unsigned char *p = NULL, *p2 = NULL;
+        int r, r_format;
+        Atom r_type;
+
+        r = XGetWindowProperty(dpy, DefaultRootWindow(dpy),
+                               supporting, 0, 1, False, xa_window,
+                               &r_type, &r_format, &count, &bytes_remain, &p);
+
+        if (r == Success && p && r_type == xa_window && r_format == 32 &&
+            count == 1) {
+            Window w = *(Window *)p;
+
+            r = XGetWindowProperty(dpy, w, supporting, 0, 1,
+                                   False, xa_window, &r_type, &r_format,
+                                   &count, &bytes_remain, &p2);
+
+            if(r == Success && p2 && *p2 == *p && r_type == xa_window &&
+               r_format == 32 && count == 1){
+                netwm = 1;
+            }
+        }
+
+        if (p)  XFree(p);
+        if (p2) XFree(p2);
+    }
+
+    if (netwm) {
+        Atom wm_state = XInternAtom(dpy, "_NET_WM_STATE", False);
+        Atom wm_fs = XInternAtom(dpy, "_NET_WM_STATE_FULLSCREEN", False);
+        XEvent xev = {};
+
+        xev.type = ClientMessage;
+        xev.xclient.window = win;
+        xev.xclient.message_type = wm_state;
+        xev.xclient.format = 32;
+        xev.xclient.data.l[0] = 1;
+        xev.xclient.data.l[1] = wm_fs;
+        xev.xclient.data.l[2] = 0;
+
+        XSendEvent(dpy, RootWindow(dpy, DefaultScreen(dpy)),
+                   False, SubstructureNotifyMask, &xev);
+    }
+}
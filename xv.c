@@ -36,9 +36,12 @@
 #include "display.h"
 #include "util.h"
 #include "memman.h"
+#include "xutil.h"
 
 #define YV12 0x32315659
 
+#define MAX_PENDING 3
+
 static Display *dpy;
 static Window win;
 static XvPortID xv_port;
@@ -48,8 +51,12 @@ static struct frame *frames;
 static struct {
     XvImage *xvi;
     XShmSegmentInfo xshm;
+    int pending;
 } *xv_frames;
 static unsigned out_x, out_y, out_w, out_h;
+static int shm_completion;
+static unsigned num_pending;
+static unsigned max_pending;
 
 static int
 xv_alloc_frames(struct frame_format *ff, unsigned bufsize,
@@ -84,6 +91,7 @@ xv_alloc_frames(struct frame_format *ff, unsigned bufsize,
         xvi->data = xshm->shmaddr;
 
         xv_frames[i].xvi = xvi;
+        xv_frames[i].pending = 0;
 
         frames[i].virt[0] = xvi->data + xvi->offsets[0];
         frames[i].virt[1] = xvi->data + xvi->offsets[2];
@@ -93,6 +101,8 @@ xv_alloc_frames(struct frame_format *ff, unsigned bufsize,
         frames[i].linesize[2] = xvi->pitches[1];
     }
 
+    max_pending = MAX(MIN(MAX_PENDING, num_frames / 2), 1);
+
     *fr = frames;
     *nf = num_frames;
 
@@ -105,61 +115,6 @@ err:
     return -1;
 }
 
-static void
-set_fullscreen(void)
-{
-    Atom supporting;
-    int netwm = 0;
-
-    supporting = XInternAtom(dpy, "_NET_SUPPORTING_WM_CHECK", True);
-
-    if (supporting != None) {
-        Atom xa_window = XInternAtom(dpy, "WINDOW", True);
-        unsigned long count, bytes_remain;
-        unsigned char *p = NULL, *p2 = NULL;
-        int r, r_format;
-        Atom r_type;
-
-        r = XGetWindowProperty(dpy, DefaultRootWindow(dpy),
-                               supporting, 0, 1, False, xa_window,
-                               &r_type, &r_format, &count, &bytes_remain, &p);
-
-        if (r == Success && p && r_type == xa_window && r_format == 32 &&
-            count == 1) {
-            Window w = *(Window *)p;
-
-            r = XGetWindowProperty(dpy, w, supporting, 0, 1,
-                                   False, xa_window, &r_type, &r_format,
-                                   &count, &bytes_remain, &p2);
-
-            if(r == Success && p2 && *p2 == *p && r_type == xa_window &&
-               r_format == 32 && count == 1){
-                netwm = 1;
-            }
-        }
-
-        if (p)  XFree(p);
-        if (p2) XFree(p2);
-    }
-
-    if (netwm) {
-        Atom wm_state = XInternAtom(dpy, "_NET_WM_STATE", False);
-        Atom wm_fs = XInternAtom(dpy, "_NET_WM_STATE_FULLSCREEN", False);
-        XEvent xev = {};
-
-        xev.type = ClientMessage;
-        xev.xclient.window = win;
-        xev.xclient.message_type = wm_state;
-        xev.xclient.format = 32;
-        xev.xclient.data.l[0] = 1;
-        xev.xclient.data.l[1] = wm_fs;
-        xev.xclient.data.l[2] = 0;
-
-        XSendEvent(dpy, RootWindow(dpy, DefaultScreen(dpy)),
-                   False, SubstructureNotifyMask, &xev);
-    }
-}
-
 static int xv_open(const char *name, struct frame_format *dp,
                    struct frame_format *ff)
 {
@@ -221,10 +176,12 @@ static int xv_open(const char *name, struct frame_format *dp,
 
     fprintf(stderr, "Xv: using port %li\n", xv_port);
 
+    shm_completion = XShmGetEventBase(dpy) + ShmCompletion;
+
     XGetWindowAttributes(dpy, RootWindow(dpy, DefaultScreen(dpy)), &attr);
     dp->width  = attr.width;
     dp->height = attr.height;
-    dp->pixfmt = PIX_FMT_YUV420P;
+    dp->pixfmt = AV_PIX_FMT_YUV420P;
 
     return 0;
 }
@@ -248,22 +205,41 @@ static int xv_enable(struct frame_format *ff, unsigned flags,
     XMapWindow(dpy, win);
 
     if (flags & OFBP_FULLSCREEN)
-        set_fullscreen();
+        ofbp_x11_fullscreen(dpy, win);
 
     return 0;
 }
 
-static void xv_prepare(struct frame *f)
+static void shm_complete(XShmCompletionEvent *ce)
 {
-    XEvent xe, cn;
+    int i;
 
-    cn.type = 0;
+    for (i = 0; i < num_frames; i++) {
+        if (xv_frames[i].pending && xv_frames[i].xshm.shmseg == ce->shmseg) {
+            xv_frames[i].pending = 0;
+            num_pending--;
+            ofbp_put_frame(&frames[i]);
+            break;
+        }
+    }
+}
 
-    while (XCheckMaskEvent(dpy, ~0, &xe))
-        if (xe.type == ConfigureNotify)
-            cn = xe;
+/* Process queued events, blocking while more than max frames are
+   still owned by the server. */
+static void xv_events(unsigned max)
+{
+    int resize = 0;
+    XEvent xe;
+
+    while (num_pending > max || XPending(dpy)) {
+        XNextEvent(dpy, &xe);
+        if (xe.type == shm_completion)
+            shm_complete((XShmCompletionEvent *)&xe);
+        else if (xe.type == ConfigureNotify)
+            resize = 1;
+    }
 
-    if (cn.type) {
+    if (resize) {
         XWindowAttributes xwa;
         XGetWindowAttributes(dpy, win, &xwa);
         out_w = ffmt.disp_w;
@@ -273,16 +249,23 @@ static void xv_prepare(struct frame *f)
     }
 }
 
+static void xv_prepare(struct frame *f)
+{
+}
+
 static void xv_show(struct frame *f)
 {
     GC gc = DefaultGC(dpy, DefaultScreen(dpy));
 
+    xv_frames[f->frame_num].pending = 1;
+    num_pending++;
+
     XvShmPutImage(dpy, xv_port, win, gc, xv_frames[f->frame_num].xvi,
                   ffmt.disp_x, ffmt.disp_y, ffmt.disp_w, ffmt.disp_h,
-                  out_x, out_y, out_w, out_h, False);
+                  out_x, out_y, out_w, out_h, True);
 
-    XSync(dpy, False);
-    ofbp_put_frame(f);
+    XFlush(dpy);
+    xv_events(max_pending);
 }
 
 static void xv_close(void)
@@ -296,6 +279,8 @@ static void xv_free_frames(struct frame *frames, unsigned nf)
 {
     int i;
 
+    xv_events(0);
+
     for (i = 0; i < num_frames; i++) {
         XShmDetach(dpy, &xv_frames[i].xshm);
         XFree(xv_frames[i].xvi);